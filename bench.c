@@ -0,0 +1,257 @@
+// Benchmarks do editor.h e do v_clone.h com cargas sintéticas.
+//
+//   bench [tamanhos...]        ex.: bench 1K 1M 64M 1G   (padrão: 1K 64K 1M 16M)
+//
+// Uma linha por medida, separada por tabs, no formato estável
+//   name  size  ops  ns/op  MB/s
+// ("-" quando a vazão não se aplica). Compare com bench_output.txt de antes da mudança.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EDITOR_IMPLEMENTATION
+#include "editor.h"
+
+#define TERMINAL_IMPLEMENTATION
+#include "terminal.h"
+
+#include "v_clone.h"
+
+#define SCREEN_ROWS 50
+#define SCREEN_COLS 160
+#define LINE_WIDTH  64    // Tamanho médio das linhas geradas
+#define MB          (1024.0 * 1024.0)
+
+static editor_t B_ed;
+static v_state_t B_v;
+
+#define V_CLR_RESET()     term_reset()
+#define V_CLR_TEXT()      do { term_reset(); term_fg_rgb(240, 240, 240); } while(0)
+#define V_CLR_LINENUM()   term_fg_rgb(221, 160, 221)
+#define V_CLR_STATUS()    do { term_fg_rgb(40, 40, 40); term_bg_rgb(186, 225, 255); } while(0)
+#define V_CLR_SELECTION() term_bg_rgb(60, 60, 60)
+#define V_CLR_MATCH()     term_bg_rgb(90, 80, 40)
+
+#define V_TERM_GOTOXY(x, y)      term_gotoxy(x, y)
+#define V_TERM_CLEAR()           term_clear()
+#define V_TERM_CURSOR_SHOW(s)    term_cursor_show(s)
+
+#define V_ED_GET_CURSOR(v)          editor_get_cursor((editor_t*)(v)->udata)
+#define V_ED_SET_CURSOR(v, pos)     editor_move_cursor((editor_t*)(v)->udata, pos)
+#define V_ED_GET_CHAR(v, pos)       editor_get_char((editor_t*)(v)->udata, pos)
+#define V_ED_GET_LENGTH(v)          editor_get_length((editor_t*)(v)->udata)
+#define V_ED_DELETE_RANGE(v, s, e)  editor_delete_range((editor_t*)(v)->udata, s, e)
+#define V_ED_INSERT_TEXT(v, txt)    editor_insert_text((editor_t*)(v)->udata, txt)
+#define V_ED_INSERT_BYTES(v, t, n)  editor_insert_bytes((editor_t*)(v)->udata, t, n)
+#define V_ED_SAVE_SNAPSHOT(v)       editor_save_snapshot((editor_t*)(v)->udata)
+#define V_ED_UNDO(v)                editor_undo((editor_t*)(v)->udata)
+#define V_ED_FIND_LINE_START(v, p)  editor_find_line_start((editor_t*)(v)->udata, p)
+#define V_ED_FIND_LINE_END(v, p)    editor_find_line_end((editor_t*)(v)->udata, p)
+#define V_ED_GET_ROW_COL(v, p, r, c) editor_get_row_col((editor_t*)(v)->udata, p, r, c)
+#define V_ED_COPY_RANGE(v, s, e, d) editor_copy_range((editor_t*)(v)->udata, s, e, d)
+#define V_ED_LINE_COUNT(v)          editor_line_count((editor_t*)(v)->udata)
+#define V_ED_LINE_OFFSET(v, l)      editor_line_offset((editor_t*)(v)->udata, l)
+#define V_ED_LINE_OF(v, p)          editor_line_of((editor_t*)(v)->udata, p)
+#define V_ED_FIND(v, q, n, s, e)    editor_find_range((editor_t*)(v)->udata, q, n, s, e)
+
+#define V_CLONE_IMPLEMENTATION
+#include "v_clone.h"
+
+// --- Infraestrutura ---
+
+static size_t out_bytes; // Bytes que o v_render mandaria ao terminal
+static FILE *results;    // O stdout original: o stdout do processo vira o terminal nulo
+
+static ssize_t null_write(void *cookie, const char *buf, size_t n) {
+    (void)cookie; (void)buf;
+    out_bytes += n;
+    return (ssize_t)n;
+}
+
+static long long now_ns(void) {
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// xorshift: a mesma sequência em toda execução
+static unsigned long long rng_state = 88172645463325252ULL;
+static size_t rnd(size_t n) {
+    rng_state ^= rng_state << 13; rng_state ^= rng_state >> 7; rng_state ^= rng_state << 17;
+    return n ? (size_t)(rng_state % n) : 0;
+}
+
+// bytes = quanto a medida processou (0 = vazão não se aplica)
+static void report(const char *name, size_t size, size_t ops, long long ns, double bytes) {
+    double sec = (double)ns / 1e9;
+    fprintf(results, "%s\t%zu\t%zu\t%.1f", name, size, ops, ops ? (double)ns / (double)ops : 0.0);
+    if (bytes > 0 && sec > 0) fprintf(results, "\t%.1f\n", bytes / MB / sec);
+    else fprintf(results, "\t-\n");
+    fflush(results);
+}
+
+// Menos repetições para arquivos grandes, para que cada medida leve ~1 s no pior caso
+static size_t ops_for(size_t size, size_t base) {
+    size_t n = size > (1 << 20) ? (size_t)((double)base * (1 << 20) / (double)size) : base;
+    return n < 20 ? 20 : n;
+}
+
+static size_t parse_size(const char *s) {
+    char *end;
+    double v = strtod(s, &end);
+    if (*end == 'K' || *end == 'k') v *= 1024;
+    else if (*end == 'M' || *end == 'm') v *= 1024 * 1024;
+    else if (*end == 'G' || *end == 'g') v *= 1024.0 * 1024 * 1024;
+    return (size_t)v;
+}
+
+// Texto parecido com código: palavras curtas, linhas de tamanho variado
+static char *make_text(size_t size) {
+    static const char *words[] = { "int", "return", "size_t", "editor", "if", "for", "while", "buffer",
+                                   "(", ")", "{", "}", ";", "=", "+", "0", "1", "cursor", "line", "gap" };
+    char *t = malloc(size + 1);
+    size_t n = 0, col = 0;
+    while (n < size) {
+        const char *w = words[rnd(20)];
+        size_t wl = strlen(w);
+        if (col + wl + 1 > LINE_WIDTH + rnd(LINE_WIDTH / 2) || n + wl + 1 > size) {
+            t[n++] = '\n'; col = 0;
+            continue;
+        }
+        memcpy(t + n, w, wl); n += wl; col += wl;
+        t[n++] = ' '; col++;
+    }
+    t[size] = 0;
+    return t;
+}
+
+// --- Cargas ---
+
+static void bench_load_save(const char *path, const char *text, size_t size) {
+    FILE *f = fopen(path, "wb");
+    fwrite(text, 1, size, f);
+    fclose(f);
+
+    long long t0 = now_ns();
+    editor_load_file(&B_ed, path);
+    report("load", size, 1, now_ns() - t0, (double)size);
+
+    editor_move_cursor(&B_ed, size / 2); // O gap no meio, como depois de uma edição
+    t0 = now_ns();
+    editor_save_file(&B_ed, path);
+    report("save", size, 1, now_ns() - t0, (double)size);
+}
+
+// Rajada de digitação num ponto só (o caso comum: o gap já está no lugar)
+static void bench_typing(size_t size) {
+    size_t n = 1 << 16;
+    editor_move_cursor(&B_ed, size / 2);
+    long long t0 = now_ns();
+    for (size_t i = 0; i < n; i++) editor_insert_char(&B_ed, (char)('a' + i % 26));
+    report("typing", size, n, now_ns() - t0, (double)n);
+    editor_delete_range(&B_ed, size / 2, size / 2 + n);
+}
+
+// Inserção e remoção em posições aleatórias: cada uma paga a viagem do gap
+static void bench_random_edits(size_t size) {
+    size_t n = ops_for(size, 20000);
+    long long t0 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        size_t len = editor_get_length(&B_ed);
+        editor_move_cursor(&B_ed, rnd(len));
+        editor_insert_bytes(&B_ed, "edit", 4);
+        size_t p = rnd(editor_get_length(&B_ed) - 4);
+        editor_delete_range(&B_ed, p, p + 4);
+    }
+    report("random_edits", size, n, now_ns() - t0, 0);
+}
+
+// Busca de um texto que não existe: varre o arquivo todo
+static void bench_search(size_t size) {
+    size_t n = ops_for(size, 200);
+    size_t len = editor_get_length(&B_ed);
+    editor_move_cursor(&B_ed, len / 2);
+    long long t0 = now_ns();
+    size_t found = 0;
+    for (size_t i = 0; i < n; i++) found += editor_find_range(&B_ed, "needle", 6, 0, len) != EDITOR_NOT_FOUND;
+    report("search", size, n, now_ns() - t0, (double)len * (double)n);
+    if (found) fprintf(stderr, "search: encontrou o que não existe\n");
+}
+
+// Saltos para linhas aleatórias (:N / NG), sem desenhar
+static void bench_line_jumps(size_t size) {
+    size_t n = ops_for(size, 100000), lines = editor_line_count(&B_ed);
+    long long t0 = now_ns();
+    for (size_t i = 0; i < n; i++) editor_move_cursor(&B_ed, editor_line_offset(&B_ed, rnd(lines)));
+    report("line_jumps", size, n, now_ns() - t0, 0);
+}
+
+// Muitos grupos de desfazer seguidos de desfazer tudo o que o log guarda
+static void bench_undo_storm(size_t size) {
+    size_t n = ops_for(size, 5000);
+    long long t0 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        editor_save_snapshot(&B_ed);
+        size_t p = rnd(editor_get_length(&B_ed));
+        editor_move_cursor(&B_ed, p);
+        editor_insert_bytes(&B_ed, "undo storm", 10);
+        editor_delete_range(&B_ed, p, p + 5);
+    }
+    for (int i = 0; i < EDITOR_UNDO_LEVELS; i++) editor_undo(&B_ed);
+    report("undo_storm", size, n + EDITOR_UNDO_LEVELS, now_ns() - t0, 0);
+}
+
+// Quadro completo do v_clone em posições aleatórias, com realce da busca
+static void bench_render(size_t size) {
+    size_t n = 2000, lines = editor_line_count(&B_ed);
+    v_init(&B_v);
+    B_v.udata = &B_ed;
+    B_v.screen_rows = SCREEN_ROWS; B_v.screen_cols = SCREEN_COLS;
+    editor_set_observer(&B_ed, NULL, NULL);
+    size_t b0 = out_bytes;
+    long long t0 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        editor_move_cursor(&B_ed, editor_line_offset(&B_ed, rnd(lines)));
+        v_render(&B_v);
+    }
+    report("render", size, n, now_ns() - t0, (double)(out_bytes - b0));
+    v_free(&B_v);
+}
+
+int main(int argc, char **argv) {
+    static const char *defaults[] = { "1K", "64K", "1M", "16M" };
+    const char **sizes = argc > 1 ? (const char **)argv + 1 : defaults;
+    int count = argc > 1 ? argc - 1 : 4;
+
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    cookie_io_functions_t io = { NULL, null_write, NULL, NULL };
+    stdout = fopencookie(NULL, "w", io);
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+
+    char path[] = "/tmp/bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) { perror("mkstemp"); return 1; }
+    close(fd);
+
+    fprintf(results, "name\tsize\tops\tns/op\tMB/s\n");
+    for (int i = 0; i < count; i++) {
+        size_t size = parse_size(sizes[i]);
+        if (size == 0) continue;
+        char *text = make_text(size);
+        bench_load_save(path, text, size);
+        free(text);
+        bench_typing(size);
+        bench_random_edits(size);
+        bench_search(size);
+        bench_line_jumps(size);
+        bench_undo_storm(size);
+        bench_render(size);
+        editor_free(&B_ed);
+    }
+    unlink(path);
+    fclose(stdout);
+    fclose(results);
+    return 0;
+}
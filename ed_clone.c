@@ -1,97 +1,965 @@
+// Um ed mínimo sobre o editor.h.
+//
+//   ed_clone [arquivo]
+//   ed_clone -s script arquivo    roda o script sem contagens de bytes; para no primeiro erro
+//
+// Endereços: N . $ /re/ ?re? 'x, com deslocamentos +N -N, separados por , ou ;
+// (, sozinho e % valem 1,$; ; sozinho vale .,$). Comandos: a i c d p n j m t s k = w wq q
+// e g/re/cmd, v/re/cmd. As linhas são as do índice de linhas do editor.h, então um
+// endereço custa O(log n) e não uma varredura desde o início do arquivo.
+#define _GNU_SOURCE
 #include <stdio.h>
+#define EDITOR_WRITEV
 #define EDITOR_IMPLEMENTATION
 #include "editor.h"
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <regex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 
-void print_line(editor_t *ed, size_t pos) {
-    size_t start = editor_find_line_start(ed, pos);
-    size_t end = editor_find_line_end(ed, pos);
-    for (size_t i = start; i < end; i++) {
-        putchar(editor_get_char(ed, i));
+#define FILENAME_SIZE 256
+
+static editor_t ed;
+static size_t cur;                 // Linha atual (1-indexada; 0 com o buffer vazio)
+static char filename[FILENAME_SIZE];
+static size_t marks[26];           // Início da linha marcada com k, mais 1 (0 = sem marca)
+static regex_t last_re;            // Última expressão, para // e s//
+static int have_re;
+static char *scratch;              // Linha montada pelo s
+static size_t scratch_cap;
+static int quit;                   // wq
+static FILE *input;                // De onde vêm os comandos e o texto de a, i, c
+static int script;                 // -s: sem contagem de bytes, para no primeiro erro
+
+// Linhas marcadas pelo g, ainda por visitar: inícios de linha em ordem crescente.
+// Uma edição antes da próxima só soma em shift; as outras passam por cada marca.
+static struct {
+    size_t *pos;
+    size_t count, next, cap;
+    size_t shift;
+    size_t here;                   // Início da linha em que o comando roda
+    int active;
+} Global;
+
+// Linhas que m e t mandam, dentro do g, sempre para o mesmo ponto: esperam aqui e
+// entram de uma vez no fim, em vez de o gap ir até o destino e voltar a cada linha.
+// Destino numérico põe o pedaço antes dos pendentes; $ põe depois.
+typedef struct { size_t off, len, lines; int append; } piece_t;
+static struct {
+    char *text;
+    size_t len, cap;
+    piece_t *pieces;
+    size_t count, cap_pieces;
+    size_t anchor;                 // Onde entram: o início da linha depois do destino
+    int active;
+} Batch;
+
+// Número de linhas do ed: o "" depois do '\n' final não é uma linha
+static size_t line_count(void) {
+    size_t n = editor_line_count(&ed), len = editor_get_length(&ed);
+    if (len == 0) return 0;
+    return editor_get_char(&ed, len - 1) == '\n' ? n - 1 : n;
+}
+
+static size_t line_start(size_t l) {
+    return l ? editor_line_offset(&ed, l - 1) : 0;
+}
+
+// Texto da linha l sem o '\n'. Se a linha atravessa o gap, o gap vai para antes dela.
+static const char *line_text(size_t l, size_t *len) {
+    size_t s = line_start(l), e = editor_line_offset(&ed, l), run;
+    if (e > s && editor_get_char(&ed, e - 1) == '\n') e--;
+    if (s < editor_get_cursor(&ed) && editor_get_cursor(&ed) < e) editor_move_cursor(&ed, s);
+    *len = e - s;
+    return editor_segment(&ed, s, &run);
+}
+
+// Linhas [a, b] no stdout num writev só, direto dos dois lados do gap
+static void print_lines(size_t a, size_t b) {
+    fflush(stdout);
+    editor_write_lines(&ed, fileno(stdout), a - 1, b - 1, 1);
+}
+
+static int line_matches(const regex_t *re, size_t l) {
+    size_t len;
+    const char *t = line_text(l, &len);
+    regmatch_t m = { 0, (regoff_t)len };
+    return regexec(re, t, 1, &m, REG_STARTEND) == 0;
+}
+
+// Leva um início de linha através de uma edição. Retorna 0 se a linha deixou de existir.
+static int track(size_t *pos, const editor_change_t *c) {
+    if (*pos < c->offset) return 1;
+    if (*pos < c->offset + c->removed) return *pos == c->offset && c->lines_removed == 0;
+    *pos = *pos - c->removed + c->inserted;
+    return 1;
+}
+
+static void on_change(void *udata, const editor_change_t *c) {
+    (void)udata;
+    for (int i = 0; i < 26; i++) {
+        size_t m = marks[i] - 1;
+        if (marks[i]) marks[i] = track(&m, c) ? m + 1 : 0;
+    }
+    if (Batch.active && Batch.anchor > c->offset) // Ponto entre linhas: não some, encolhe junto
+        Batch.anchor = Batch.anchor >= c->offset + c->removed ? Batch.anchor - c->removed + c->inserted : c->offset;
+    if (Global.active) track(&Global.here, c);
+    if (!Global.active || Global.next == Global.count) return;
+    if (Global.pos[Global.next] + Global.shift >= c->offset + c->removed) {
+        Global.shift += c->inserted - c->removed;
+        return;
+    }
+    size_t k = Global.next;
+    for (size_t i = Global.next; i < Global.count; i++) {
+        size_t m = Global.pos[i] + Global.shift;
+        if (track(&m, c)) Global.pos[k++] = m;
+    }
+    Global.count = k;
+    Global.shift = 0;
+}
+
+// Padrão até o delimitador (ou o fim). Vazio reaproveita o anterior. Retorna o resto ou NULL.
+static const char *parse_re(const char *p, char delim) {
+    char pat[1024];
+    size_t n = 0;
+    for (; *p && *p != delim; p++) {
+        if (*p == '\\' && p[1] == delim) p++;
+        else if (*p == '\\' && p[1]) pat[n++] = *p++;
+        if (n + 1 >= sizeof(pat)) return NULL;
+        pat[n++] = *p;
+    }
+    pat[n] = '\0';
+    if (*p == delim) p++;
+    if (n == 0) return have_re ? p : NULL;
+    regex_t re;
+    if (regcomp(&re, pat, 0) != 0) return NULL;
+    if (have_re) regfree(&last_re);
+    last_re = re;
+    have_re = 1;
+    return p;
+}
+
+// Um endereço com seus deslocamentos. Retorna 1 e *line, 0 se não há endereço, -1 se é inválido.
+static int parse_addr(const char **pp, size_t *line) {
+    const char *p = *pp;
+    size_t n = line_count(), l = cur;
+    int found = 1;
+    if (isdigit((unsigned char)*p)) { char *e; l = strtoul(p, &e, 10); p = e; }
+    else if (*p == '.') p++;
+    else if (*p == '$') { l = n; p++; }
+    else if (*p == '\'') {
+        if (p[1] < 'a' || p[1] > 'z' || !marks[p[1] - 'a']) return -1;
+        l = editor_line_of(&ed, marks[p[1] - 'a'] - 1) + 1;
+        p += 2;
+    } else if (*p == '/' || *p == '?') {
+        char delim = *p;
+        if (!(p = parse_re(p + 1, delim)) || n == 0) return -1;
+        // A partir da linha seguinte (ou anterior), dando a volta no arquivo
+        size_t i;
+        for (i = 0; i < n; i++) {
+            l = delim == '/' ? l % n + 1 : (l + n - 2) % n + 1;
+            if (line_matches(&last_re, l)) break;
+        }
+        if (i == n) return -1;
+    } else found = 0;
+    while (*p == '+' || *p == '-') {
+        int sign = *p++;
+        size_t k = 1;
+        if (isdigit((unsigned char)*p)) { char *e; k = strtoul(p, &e, 10); p = e; }
+        if (sign == '-' && k > l) return -1;
+        l = sign == '+' ? l + k : l - k;
+        found = 1;
+    }
+    if (!found) return 0;
+    if (l > n) return -1;
+    *line = l;
+    *pp = p;
+    return 1;
+}
+
+// Linhas inseridas por text[0, len)
+static size_t count_lines(const char *text, size_t len) {
+    size_t k = 0;
+    for (const char *p = text; (p = memchr(p, '\n', (size_t)(text + len - p))) != NULL; p++) k++;
+    return k + (len && text[len - 1] != '\n');
+}
+
+// Insere text depois da linha l, começando numa linha nova. Retorna quantas linhas entraram.
+static size_t insert_after(size_t l, const char *text, size_t len) {
+    size_t pos = editor_line_offset(&ed, l), total = editor_get_length(&ed);
+    if (l == 0) pos = 0;
+    editor_move_cursor(&ed, pos);
+    if (l > 0 && pos == total && total > 0 && editor_get_char(&ed, total - 1) != '\n') editor_insert_char(&ed, '\n');
+    editor_insert_bytes(&ed, text, len);
+    return count_lines(text, len);
+}
+
+// Lê linhas até "." e as insere depois da linha l. Retorna quantas.
+size_t input_mode(size_t l) {
+    char *line = NULL;
+    size_t len = 0, k = 0;
+    ssize_t n;
+    while ((n = getline(&line, &len, input)) != -1) {
+        if (strcmp(line, ".\n") == 0 || strcmp(line, ".") == 0) break;
+        k += insert_after(l + k, line, (size_t)n);
+    }
+    free(line);
+    return k;
+}
+
+// Linhas [a, b] numa cópia, terminadas em '\n'
+static char *copy_lines(size_t a, size_t b, size_t *len) {
+    size_t s = line_start(a), e = editor_line_offset(&ed, b);
+    char *t = malloc(e - s + 1);
+    *len = editor_copy_range(&ed, s, e, t);
+    if (*len == 0 || t[*len - 1] != '\n') t[(*len)++] = '\n';
+    return t;
+}
+
+static void delete_lines(size_t a, size_t b) {
+    editor_delete_range(&ed, line_start(a), editor_line_offset(&ed, b));
+}
+
+static void scratch_put(size_t *n, const char *s, size_t len) {
+    if (*n + len > scratch_cap) {
+        scratch_cap = (*n + len) * 2;
+        scratch = realloc(scratch, scratch_cap);
+    }
+    memcpy(scratch + *n, s, len);
+    *n += len;
+}
+
+// Troca de s/re/rep/[g][N] em t[0, len), montada em scratch. Retorna o tamanho ou -1 se nada casou.
+static ssize_t substitute_text(const regex_t *re, const char *t, size_t len, const char *rep, int global, size_t nth) {
+    size_t n = 0, from = 0, hits = 0, pos = 0;
+    int changed = 0;
+    regmatch_t m[10];
+    while (pos <= len) {
+        m[0].rm_so = (regoff_t)pos; m[0].rm_eo = (regoff_t)len;
+        if (regexec(re, t, 10, m, REG_STARTEND | (pos > 0 ? REG_NOTBOL : 0)) != 0) break;
+        size_t so = (size_t)m[0].rm_so, eo = (size_t)m[0].rm_eo;
+        if (++hits >= nth) {
+            scratch_put(&n, t + from, so - from);
+            for (const char *r = rep; *r; r++) {
+                if (*r == '&') scratch_put(&n, t + so, eo - so);
+                else if (*r == '\\' && isdigit((unsigned char)r[1])) {
+                    int g = *++r - '0';
+                    if (m[g].rm_so >= 0) scratch_put(&n, t + m[g].rm_so, (size_t)(m[g].rm_eo - m[g].rm_so));
+                } else {
+                    if (*r == '\\' && r[1]) r++;
+                    scratch_put(&n, r, 1);
+                }
+            }
+            from = eo;
+            changed = 1;
+            if (!global) break;
+        }
+        pos = eo > so ? eo : eo + 1; // Casamento vazio: anda um caractere
+    }
+    if (!changed) return -1;
+    scratch_put(&n, t + from, len - from);
+    return (ssize_t)n;
+}
+
+// s na linha l do buffer. Retorna 1 se trocou algo.
+static int substitute_line(size_t l, const char *rep, int global, size_t nth) {
+    size_t len;
+    const char *t = line_text(l, &len);
+    ssize_t n = substitute_text(&last_re, t, len, rep, global, nth);
+    if (n < 0) return 0;
+    size_t s = line_start(l);
+    editor_delete_range(&ed, s, s + len);
+    editor_move_cursor(&ed, s);
+    editor_insert_bytes(&ed, scratch, (size_t)n);
+    return 1;
+}
+
+// O resto de s depois do comando: /re/rep/ e as flags g, N e p. Retorna 0 se é inválido.
+static int parse_sub(const char *p, char *rep, size_t cap, int *global, size_t *nth, int *print) {
+    char delim = *p;
+    if (!delim || delim == ' ' || delim == '\n') return 0;
+    if (!(p = parse_re(p + 1, delim))) return 0;
+    size_t rn = 0;
+    for (; *p && *p != delim; p++) {
+        if (*p == '\\' && p[1] == delim) p++;
+        else if (*p == '\\' && p[1]) rep[rn++] = *p++;
+        if (rn + 1 >= cap) return 0;
+        rep[rn++] = *p;
+    }
+    rep[rn] = '\0';
+    if (*p == delim) p++;
+    *global = *print = 0;
+    *nth = 1;
+    for (; *p; p++) {
+        if (*p == 'g') *global = 1;
+        else if (*p == 'p') *print = 1;
+        else if (isdigit((unsigned char)*p)) { char *e; *nth = strtoul(p, &e, 10); p = e - 1; }
+        else return 0;
+    }
+    return 1;
+}
+
+static int write_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w <= 0) return 0;
+        p += w; n -= (size_t)w;
+    }
+    return 1;
+}
+
+// Temporário ao lado de name, com o modo do arquivo que vai substituir
+static int temp_open(const char *name, char *tmp, size_t cap) {
+    snprintf(tmp, cap, "%s.XXXXXX", name);
+    int fd = mkstemp(tmp);
+    struct stat st;
+    mode_t mask = umask(0);
+    umask(mask);
+    if (fd >= 0) fchmod(fd, stat(name, &st) == 0 ? st.st_mode & 07777 : 0666 & ~mask);
+    return fd;
+}
+
+static int temp_commit(int fd, const char *tmp, const char *name, int ok) {
+    ok = fsync(fd) == 0 && ok;
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(tmp, name) == 0;
+    if (!ok) unlink(tmp);
+    return ok;
+}
+
+// w do -s no buffer normal: grava num temporário ao lado e renomeia por cima
+static int save_atomic(const char *name) {
+    char tmp[FILENAME_SIZE + 8];
+    int fd = temp_open(name, tmp, sizeof(tmp)), ok = fd >= 0;
+    if (!ok) return 0;
+    for (size_t pos = 0, run, len = editor_get_length(&ed); ok && pos < len; pos += run) {
+        const char *seg = editor_segment(&ed, pos, &run);
+        ok = write_all(fd, seg, run);
+    }
+    return temp_commit(fd, tmp, name, ok);
+}
+
+static void batch_add(size_t at, const char *text, size_t len, size_t lines, int append) {
+    if (Batch.len + len > Batch.cap) {
+        Batch.cap = (Batch.len + len) * 2;
+        Batch.text = realloc(Batch.text, Batch.cap);
+    }
+    if (Batch.count == Batch.cap_pieces) {
+        Batch.cap_pieces = Batch.cap_pieces ? Batch.cap_pieces * 2 : 256;
+        Batch.pieces = realloc(Batch.pieces, sizeof(piece_t) * Batch.cap_pieces);
+    }
+    if (!Batch.active) { Batch.active = 1; Batch.anchor = at; Batch.len = Batch.count = 0; }
+    memcpy(Batch.text + Batch.len, text, len);
+    Batch.pieces[Batch.count++] = (piece_t){ Batch.len, len, lines, append };
+    Batch.len += len;
+}
+
+// Os pedaços antes dos pendentes saem na ordem inversa de chegada, os depois na ordem
+static void batch_flush(void) {
+    if (!Batch.active) return;
+    Batch.active = 0;
+    char *out = malloc(Batch.len + 1);
+    size_t n = 0, lines = 0;
+    for (size_t i = Batch.count; i-- > 0;) {
+        piece_t *pc = &Batch.pieces[i];
+        if (!pc->append) { memcpy(out + n, Batch.text + pc->off, pc->len); n += pc->len; lines += pc->lines; }
+    }
+    for (size_t i = 0; i < Batch.count; i++) {
+        piece_t *pc = &Batch.pieces[i];
+        if (pc->append) { memcpy(out + n, Batch.text + pc->off, pc->len); n += pc->len; lines += pc->lines; }
+    }
+    size_t l = Batch.anchor ? editor_line_of(&ed, Batch.anchor - 1) + 1 : 0;
+    piece_t *last = &Batch.pieces[Batch.count - 1];
+    insert_after(l, out, n);
+    cur = l + (last->append ? lines : last->lines);
+    free(out);
+}
+
+static int run_command(const char *p);
+
+// g/re/cmd e v/re/cmd: uma passada marca as linhas, outra roda cmd em cada uma
+static int global_command(const char *p, size_t a, size_t b, int want) {
+    if (Global.active || !*p) return 0;
+    char delim = *p;
+    if (!(p = parse_re(p + 1, delim))) return 0;
+    Global.count = Global.next = Global.shift = 0;
+    for (size_t l = a; l <= b && l > 0; l++) {
+        if (line_matches(&last_re, l) != want) continue;
+        if (Global.count == Global.cap) {
+            Global.cap = Global.cap ? Global.cap * 2 : 1024;
+            Global.pos = realloc(Global.pos, sizeof(size_t) * Global.cap);
+        }
+        Global.pos[Global.count++] = line_start(l);
     }
+    const char *cmd = *p ? p : "p";
+    int ok = 1;
+    Global.active = 1;
+    while (ok && Global.next < Global.count) {
+        size_t s = Global.pos[Global.next++] + Global.shift, len = editor_get_length(&ed);
+        // Marca que caiu no meio de uma linha: a linha dela foi juntada a outra
+        if (s >= len || (s > 0 && editor_get_char(&ed, s - 1) != '\n')) continue;
+        cur = editor_line_of(&ed, s) + 1;
+        Global.here = s;
+        if (!(ok = run_command(cmd)) && Batch.active) {
+            batch_flush();
+            cur = editor_line_of(&ed, Global.here) + 1;
+            ok = run_command(cmd);
+        }
+    }
+    batch_flush();
+    Global.active = 0;
+    return ok;
+}
+
+// Os endereços antes do comando, resolvidos por addr. Retorna 1, ou o negativo que addr devolveu.
+static int parse_range(const char **pp, size_t *a, size_t *b, int *naddr, size_t n, int (*addr)(const char **, size_t *)) {
+    const char *p = *pp;
+    int r;
+    *a = *b = cur; *naddr = 0;
+    while (*p == ' ') p++;
+    if (*p == ',' || *p == '%' || *p == ';') {
+        *a = *p == ';' ? cur : 1; *b = n; *naddr = 2; p++;
+        if (*p != ' ' && (r = addr(&p, b)) < 0) return r;
+    } else if ((r = addr(&p, a)) != 0) {
+        if (r < 0) return r;
+        *b = *a; *naddr = 1;
+        while (*p == ',' || *p == ';') {
+            if (*p++ == ';') cur = *a;
+            *a = *b;
+            if ((r = addr(&p, b)) < 0) return r;
+            if (r == 0) *b = *a;
+            *naddr = 2;
+        }
+    }
+    *pp = p;
+    return *a <= *b ? 1 : -1;
+}
+
+// Executa uma linha de comando. Retorna 0 em erro.
+static int run_command(const char *p) {
+    size_t a, b, n = line_count();
+    int naddr;
+    if (parse_range(&p, &a, &b, &naddr, n, parse_addr) != 1) return 0;
+    char c = *p ? *p++ : 0;
+    // Comandos que precisam de uma linha de verdade
+    if (c && strchr("cdjmnpstk", c) && (a == 0 || n == 0)) return 0;
+    switch (c) {
+    case 0: // Só endereço: vai para a linha e a imprime; nada: a próxima linha
+        if (naddr == 0) { if (cur >= n) return 0; b = cur + 1; }
+        if (b == 0) return 0;
+        cur = b;
+        print_lines(b, b);
+        return 1;
+    case 'a': cur = b + input_mode(b); return 1;
+    case 'i': cur = (b ? b - 1 : 0) + input_mode(b ? b - 1 : 0); if (cur == 0 && n) cur = 1; return 1;
+    case 'c': delete_lines(a, b); cur = a - 1 + input_mode(a - 1); if (cur == 0 && line_count()) cur = 1; return 1;
+    case 'd':
+        delete_lines(a, b);
+        n = line_count();
+        cur = a <= n ? a : n;
+        return 1;
+    case 'p':
+        print_lines(a, b);
+        cur = b;
+        return 1;
+    case 'n':
+        for (size_t l = a, len; l <= b; l++) {
+            const char *t = line_text(l, &len);
+            printf("%zu\t", l);
+            fwrite(t, 1, len, stdout);
+            putchar('\n');
+        }
+        cur = b;
+        return 1;
+    case 'j': {
+        if (naddr < 2) b = a + 1;
+        if (b > n) return 0;
+        // De trás para a frente, para que os offsets das linhas de cima continuem valendo
+        for (size_t l = b - 1; l >= a; l--) {
+            size_t e = editor_line_offset(&ed, l);
+            editor_delete_range(&ed, e - 1, e);
+        }
+        cur = a;
+        return 1;
+    }
+    case 'm': case 't': {
+        size_t dest;
+        const char *d = p;
+        if (parse_addr(&p, &dest) != 1) return 0;
+        if (c == 'm' && dest >= a && dest < b) return 0;
+        // Dentro do g, destino N ou $ vai para o lote. Os números aqui não contam as linhas
+        // pendentes: outro destino falha, e o g esvazia o lote e repete o comando.
+        int plain = Global.active && (strspn(d, "0123456789") == (size_t)(p - d) || (*d == '$' && p == d + 1));
+        if (Batch.active && (!plain || editor_line_offset(&ed, dest) != Batch.anchor)) return 0;
+        size_t len, k = b - a + 1;
+        char *text = copy_lines(a, b, &len);
+        if (plain && (Batch.active || c == 't' || (dest != b && dest + 1 != a))) {
+            if (c == 'm') { delete_lines(a, b); if (dest > b) dest -= k; }
+            batch_add(editor_line_offset(&ed, dest), text, len, k, *d == '$');
+        } else if (c == 'm' && dest != b && dest + 1 != a) {
+            delete_lines(a, b);
+            if (dest > b) dest -= k;
+            insert_after(dest, text, len);
+            cur = dest + k;
+        } else if (c == 't') {
+            insert_after(dest, text, len);
+            cur = dest + k;
+        } else cur = b;
+        free(text);
+        return 1;
+    }
+    case 's': {
+        char rep[1024];
+        int global, print;
+        size_t nth;
+        if (!parse_sub(p, rep, sizeof(rep), &global, &nth, &print)) return 0;
+        int any = 0;
+        for (size_t l = a; l <= b; l++) if (substitute_line(l, rep, global, nth)) { any = 1; cur = l; }
+        if (!any) return Global.active; // Dentro do g, linha sem troca não é erro
+        if (print) print_lines(cur, cur);
+        return 1;
+    }
+    case 'k':
+        if (*p < 'a' || *p > 'z') return 0;
+        marks[*p - 'a'] = line_start(b) + 1;
+        return 1;
+    case 'g': case 'v':
+        if (naddr == 0) { a = 1; b = n; }
+        if (a == 0 || n == 0) return 0;
+        return global_command(p, a, b, c == 'g');
+    case '=':
+        printf("%zu\n", naddr ? b : n);
+        return 1;
+    case 'w': {
+        if (*p == 'q') { if (p[1]) return 0; quit = 1; p++; }
+        while (*p == ' ') p++;
+        if (*p) { if (strlen(p) >= FILENAME_SIZE) return 0; strcpy(filename, p); }
+        if (!filename[0] || !(script ? save_atomic(filename) : editor_save_file(&ed, filename))) return 0;
+        if (!script) printf("%zu\n", editor_get_length(&ed));
+        return 1;
+    }
+    default:
+        return 0;
+    }
+}
+
+// --- -s: scripts sobre arquivos maiores que a memória ---
+//
+// Enquanto os endereços só andam para a frente, o script corre sobre o arquivo mapeado, sem
+// editor_t: o que não muda vai para o temporário por copy_file_range (sendfile, ou write, se o
+// sistema de arquivos recusa) e só as linhas tocadas passam pela memória. Um comando que
+// precisaria voltar (j m t k u, ?re?, 'x, uma linha já escrita, w para outro arquivo) devolve
+// STREAM_BACK, e o script recomeça sobre o buffer normal. Nos dois caminhos a escrita vai para
+// um temporário ao lado do arquivo, renomeado por cima no fim.
+
+#define STREAM_BUF  (1 << 16)   // Saída montada em memória antes de cada write
+#define STREAM_COPY (1 << 16)   // Trechos intactos menores que isso vão pelo buffer
+#define STREAM_BACK (-2)        // O comando precisa de acesso aleatório
+
+static struct {
+    const char *in;             // O arquivo mapeado
+    size_t size;
+    int in_fd, out_fd;
+    char tmp[FILENAME_SIZE + 8];
+    size_t copy_from;           // Início da entrada intacta que ainda não foi escrita
+    size_t front, front_line;   // Primeira linha em aberto: offset na entrada, número no texto atual
+    size_t seek, seek_line;     // Última linha achada a partir de front
+    size_t last;                // $
+    char buf[STREAM_BUF];
+    size_t buf_len;
+    char tail;                  // Último byte escrito
+    int copy, failed;
+} Stream;
+
+static size_t executed;         // Comandos que já rodaram sem erro, para não repetir o que imprimiram
+
+static void stream_flush(void) {
+    if (Stream.buf_len && !write_all(Stream.out_fd, Stream.buf, Stream.buf_len)) Stream.failed = 1;
+    Stream.buf_len = 0;
+}
+
+static void stream_write(const char *p, size_t n) {
+    if (n == 0) return;
+    Stream.tail = p[n - 1];
+    if (Stream.buf_len + n > STREAM_BUF) stream_flush();
+    if (n >= STREAM_BUF) { if (!write_all(Stream.out_fd, p, n)) Stream.failed = 1; return; }
+    memcpy(Stream.buf + Stream.buf_len, p, n);
+    Stream.buf_len += n;
+}
+
+// Escreve a entrada intacta até to
+static void stream_take(size_t to) {
+    size_t from = Stream.copy_from;
+    if (to <= from) return;
+    Stream.copy_from = to;
+    if (to - from < STREAM_COPY) { stream_write(Stream.in + from, to - from); return; }
+    stream_flush();
+    Stream.tail = Stream.in[to - 1];
+    off_t off = (off_t)from;
+    while (!Stream.failed && (size_t)off < to) {
+        ssize_t n = -1;
+        if (Stream.copy && (n = copy_file_range(Stream.in_fd, &off, Stream.out_fd, NULL, to - (size_t)off, 0)) <= 0)
+            Stream.copy = 0;
+        if (n <= 0 && (n = sendfile(Stream.out_fd, Stream.in_fd, &off, to - (size_t)off)) <= 0)
+            Stream.failed = !write_all(Stream.out_fd, Stream.in + off, to - (size_t)off);
+        if (n <= 0) break;
+    }
+}
+
+// A próxima linha em aberto passa a ser line, no offset off da entrada
+static void stream_at(size_t line, size_t off) {
+    Stream.front_line = Stream.seek_line = line;
+    Stream.front = Stream.seek = off;
+}
+
+// Início da linha l do texto atual (l >= front_line; depois de $ é o fim do arquivo)
+static size_t stream_offset(size_t l) {
+    if (l < Stream.seek_line) { Stream.seek = Stream.front; Stream.seek_line = Stream.front_line; }
+    while (Stream.seek_line < l && Stream.seek < Stream.size) {
+        const char *nl = memchr(Stream.in + Stream.seek, '\n', Stream.size - Stream.seek);
+        Stream.seek = nl ? (size_t)(nl - Stream.in) + 1 : Stream.size;
+        Stream.seek_line++;
+    }
+    return Stream.seek;
+}
+
+// Texto da linha l sem o '\n'; *start e *next são os inícios dela e da seguinte
+static const char *stream_line(size_t l, size_t *len, size_t *start, size_t *next) {
+    size_t s = stream_offset(l), e = stream_offset(l + 1);
+    *start = s; *next = e;
+    if (e > s && Stream.in[e - 1] == '\n') e--;
+    *len = e - s;
+    return Stream.in + s;
+}
+
+static void stream_print(size_t l, int number) {
+    size_t len, s, e;
+    const char *t = stream_line(l, &len, &s, &e);
+    if (number) printf("%zu\t", l);
+    fwrite(t, 1, len, stdout);
     putchar('\n');
 }
 
-void print_all(editor_t *ed) {
-    char *s = editor_to_string(ed);
-    if (s) {
-        printf("%s", s);
-        if (s[0] != '\0' && s[strlen(s)-1] != '\n') putchar('\n');
-        free(s);
+// Como parse_addr, sobre as linhas ainda em aberto
+static int stream_addr(const char **pp, size_t *line) {
+    const char *p = *pp;
+    size_t n = Stream.last, l = cur;
+    int found = 1;
+    if (isdigit((unsigned char)*p)) { char *e; l = strtoul(p, &e, 10); p = e; }
+    else if (*p == '.') p++;
+    else if (*p == '$') { l = n; p++; }
+    else if (*p == '\'' || *p == '?') return STREAM_BACK;
+    else if (*p == '/') {
+        if (!(p = parse_re(p + 1, '/')) || n == 0) return -1;
+        size_t i;
+        for (i = 0; i < n; i++) {
+            l = l % n + 1; // Dar a volta só serve se nada foi escrito ainda
+            if (l < Stream.front_line) return STREAM_BACK;
+            size_t len, s, e;
+            const char *t = stream_line(l, &len, &s, &e);
+            regmatch_t m = { 0, (regoff_t)len };
+            if (regexec(&last_re, t, 1, &m, REG_STARTEND) == 0) break;
+        }
+        if (i == n) return -1;
+    } else found = 0;
+    while (*p == '+' || *p == '-') {
+        int sign = *p++;
+        size_t k = 1;
+        if (isdigit((unsigned char)*p)) { char *e; k = strtoul(p, &e, 10); p = e; }
+        if (sign == '-' && k > l) return -1;
+        l = sign == '+' ? l + k : l - k;
+        found = 1;
+    }
+    if (!found) return 0;
+    if (l > n) return -1;
+    *line = l;
+    *pp = p;
+    return 1;
+}
+
+// Linhas de a, i, c até "." numa cópia. *lines recebe quantas.
+static char *read_text(size_t *len, size_t *lines) {
+    char *text = NULL, *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    FILE *f = open_memstream(&text, len);
+    *lines = 0;
+    while ((n = getline(&line, &cap, input)) != -1) {
+        if (strcmp(line, ".\n") == 0 || strcmp(line, ".") == 0) break;
+        fwrite(line, 1, (size_t)n, f);
+        if (line[n - 1] != '\n') fputc('\n', f);
+        (*lines)++;
     }
+    fclose(f);
+    free(line);
+    return text;
 }
 
-void input_mode(editor_t *ed) {
+// Depois do w só pode vir q
+static int script_ends(void) {
+    long at = ftell(input);
     char *line = NULL;
-    size_t len = 0;
-    while (getline(&line, &len, stdin) != -1) {
-        if (strcmp(line, ".\n") == 0) break;
-        editor_insert_text(ed, line);
+    size_t cap = 0;
+    ssize_t n;
+    int end = 1;
+    while (end && (n = getline(&line, &cap, input)) != -1) {
+        while (n > 0 && isspace((unsigned char)line[n - 1])) line[--n] = '\0';
+        end = n == 0 || strcmp(line, "q") == 0 || strcmp(line, "Q") == 0;
     }
     free(line);
+    fseek(input, at, SEEK_SET);
+    return end;
 }
 
-int main(int argc, char **argv) {
-    editor_t ed;
-    
-    if (argc > 1) {
-        if (editor_load_file(&ed, argv[1])) {
-            printf("%zu\n", editor_get_length(&ed));
-        } else {
-            editor_init(&ed, 1024);
+// g/re/cmd e v/re/cmd com cmd d, p, n ou s, numa passada sobre [a, b]
+static int stream_global(const char *p, size_t a, size_t b, int want) {
+    char delim = *p, rep[1024];
+    if (!delim || !(p = parse_re(p + 1, delim))) return 0;
+    const char *cmd = *p ? p : "p";
+    regex_t gre = last_re;
+    int sub = *cmd == 's', own = 0, global = 0, print = 0;
+    size_t nth = 1;
+    if (sub) {
+        if (cmd[1] && cmd[2] != cmd[1]) { have_re = 0; own = 1; } // s com padrão próprio: o do g fica em gre
+        if (!parse_sub(cmd + 1, rep, sizeof(rep), &global, &nth, &print)) {
+            if (own && have_re) regfree(&gre);
+            else if (own) { last_re = gre; have_re = 1; }
+            return 0;
         }
-    } else {
-        editor_init(&ed, 1024);
+    } else if (strcmp(cmd, "d") && strcmp(cmd, "p") && strcmp(cmd, "n")) return STREAM_BACK;
+
+    size_t pos = stream_offset(a), l = a, front = 0, front_line = 0;
+    for (size_t i = a; i <= b; i++) {
+        const char *t = Stream.in + pos, *nl = memchr(t, '\n', Stream.size - pos);
+        size_t len = nl ? (size_t)(nl - t) : Stream.size - pos, next = nl ? pos + len + 1 : Stream.size;
+        regmatch_t m = { 0, (regoff_t)len };
+        if ((regexec(own ? &gre : &last_re, t, 1, &m, REG_STARTEND) == 0) == want) {
+            cur = l;
+            if (*cmd == 'd') {
+                stream_take(pos);
+                Stream.copy_from = next;
+                Stream.last--;
+                front = next; front_line = l;
+                pos = next;
+                continue;
+            } else if (sub) {
+                ssize_t k = substitute_text(&last_re, t, len, rep, global, nth);
+                if (k >= 0) {
+                    stream_take(pos);
+                    stream_write(scratch, (size_t)k);
+                    Stream.copy_from = pos + len;
+                    front = next; front_line = l + 1;
+                    if (print) { fwrite(scratch, 1, (size_t)k, stdout); putchar('\n'); }
+                }
+            } else {
+                if (*cmd == 'n') printf("%zu\t", l);
+                fwrite(t, 1, len, stdout);
+                putchar('\n');
+            }
+        }
+        pos = next;
+        l++;
+    }
+    if (front_line) stream_at(front_line, front);
+    if (cur > Stream.last) cur = Stream.last;
+    if (own) regfree(&gre);
+    return 1;
+}
+
+// Como run_command, sobre o arquivo mapeado. Retorna 1, 0 em erro ou STREAM_BACK.
+static int stream_command(const char *p) {
+    size_t a, b, n = Stream.last, f = Stream.front_line;
+    int naddr, r;
+    if ((r = parse_range(&p, &a, &b, &naddr, n, stream_addr)) != 1) return r == STREAM_BACK ? r : 0;
+    char c = *p ? *p++ : 0;
+    if (c && strchr("cdnps", c) && (a == 0 || n == 0)) return 0;
+    switch (c) {
+    case 0:
+        if (naddr == 0) { if (cur >= n) return 0; b = cur + 1; }
+        if (b == 0) return 0;
+        if (b < f) return STREAM_BACK;
+        stream_print(b, 0);
+        cur = b;
+        return 1;
+    case 'p': case 'n':
+        if (a < f) return STREAM_BACK;
+        if (c == 'n') for (size_t l = a; l <= b; l++) stream_print(l, 1);
+        else {
+            size_t s = stream_offset(a), e = stream_offset(b + 1);
+            fwrite(Stream.in + s, 1, e - s, stdout);
+            if (e > s && Stream.in[e - 1] != '\n') putchar('\n');
+        }
+        cur = b;
+        return 1;
+    case '=':
+        printf("%zu\n", naddr ? b : n);
+        return 1;
+    case 'd':
+        if (a < f) return STREAM_BACK;
+        stream_take(stream_offset(a));
+        Stream.copy_from = stream_offset(b + 1);
+        stream_at(a, Stream.copy_from);
+        Stream.last -= b - a + 1;
+        cur = a <= Stream.last ? a : Stream.last;
+        return 1;
+    case 'a': case 'i': case 'c': {
+        size_t at = c == 'a' ? b + 1 : c == 'i' ? (b ? b : 1) : a; // Primeira linha depois do texto
+        if (at < f) return STREAM_BACK;
+        size_t len, k, s = stream_offset(at), e = c == 'c' ? stream_offset(b + 1) : s;
+        char *text = read_text(&len, &k);
+        stream_take(s);
+        if (c == 'c') Stream.copy_from = e;
+        if (len && s == Stream.size && Stream.tail != '\n') stream_write("\n", 1); // Depois de uma última linha sem '\n'
+        stream_write(text, len);
+        free(text);
+        Stream.last = Stream.last - (c == 'c' ? b - a + 1 : 0) + k;
+        stream_at(at + k, e);
+        cur = at - 1 + k;
+        if (cur == 0 && Stream.last) cur = 1;
+        return 1;
+    }
+    case 's': {
+        if (a < f) return STREAM_BACK;
+        char rep[1024];
+        int global, print;
+        size_t nth, front = 0, shown = 0;
+        if (!parse_sub(p, rep, sizeof(rep), &global, &nth, &print)) return 0;
+        for (size_t l = a; l <= b; l++) {
+            size_t len, s, e;
+            const char *t = stream_line(l, &len, &s, &e);
+            ssize_t k = substitute_text(&last_re, t, len, rep, global, nth);
+            if (k < 0) continue;
+            stream_take(s);
+            stream_write(scratch, (size_t)k);
+            Stream.copy_from = s + len; // O '\n' fica na entrada intacta
+            cur = l; front = e; shown = (size_t)k;
+        }
+        if (!front) return 0;
+        stream_at(cur + 1, front);
+        if (print) { fwrite(scratch, 1, shown, stdout); putchar('\n'); }
+        return 1;
+    }
+    case 'g': case 'v':
+        if (naddr == 0) { a = 1; b = n; }
+        if (a == 0 || n == 0) return 0;
+        if (a < f) return STREAM_BACK;
+        return stream_global(p, a, b, c == 'g');
+    case 'w': {
+        if (*p == 'q') { if (p[1]) return 0; quit = 1; p++; }
+        while (*p == ' ') p++;
+        if ((*p && strcmp(p, filename) != 0) || !script_ends()) return STREAM_BACK;
+        stream_take(Stream.size);
+        stream_flush();
+        int ok = temp_commit(Stream.out_fd, Stream.tmp, filename, !Stream.failed);
+        Stream.out_fd = -1;
+        quit = 1;
+        return ok;
+    }
+    default:
+        return STREAM_BACK;
+    }
+}
+
+static int stream_open(const char *name) {
+    struct stat st;
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) { if (fd >= 0) close(fd); return 0; }
+    Stream.size = (size_t)st.st_size;
+    Stream.in = Stream.size ? mmap(NULL, Stream.size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    if (Stream.in == MAP_FAILED || (Stream.out_fd = temp_open(name, Stream.tmp, sizeof(Stream.tmp))) < 0) {
+        if (Stream.in != MAP_FAILED && Stream.size) munmap((void *)Stream.in, Stream.size);
+        close(fd);
+        return 0;
+    }
+    if (Stream.size) madvise((void *)Stream.in, Stream.size, MADV_SEQUENTIAL);
+    Stream.in_fd = fd;
+    Stream.copy = 1;
+    Stream.tail = '\n';
+    Stream.last = 0;
+    for (const char *p = Stream.in, *end = p + Stream.size; p < end; Stream.last++) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        p = nl ? nl + 1 : end;
     }
+    stream_at(1, 0);
+    return 1;
+}
+
+static void stream_close(void) {
+    if (Stream.out_fd >= 0) { close(Stream.out_fd); unlink(Stream.tmp); }
+    if (Stream.size) munmap((void *)Stream.in, Stream.size);
+    close(Stream.in_fd);
+}
 
+// Lê e roda comandos até q, wq ou o fim da entrada. No -s, para no primeiro erro (ou no
+// primeiro STREAM_BACK) e devolve o resultado dele. Os primeiros skip comandos rodam sem
+// imprimir: são os que o caminho do -s sobre o arquivo mapeado já rodou.
+static int command_loop(int (*exec)(const char *), size_t skip) {
     char *cmd = NULL;
     size_t cmd_len = 0;
+    ssize_t n;
+    int r = 1;
+    FILE *null_out = skip ? fopen("/dev/null", "w") : NULL, *shown = stdout;
+    while ((n = getline(&cmd, &cmd_len, input)) != -1) {
+        if (n > 0 && cmd[n - 1] == '\n') cmd[--n] = '\0';
+        if (strcmp(cmd, "q") == 0 || strcmp(cmd, "Q") == 0) break;
+        if (skip && null_out) { stdout = null_out; skip--; }
+        r = exec(cmd);
+        stdout = shown;
+        if (r == 1) { executed++; if (quit) break; continue; }
+        if (r != STREAM_BACK) fprintf(script ? stderr : stdout, "?\n");
+        if (script) break;
+    }
+    if (null_out) fclose(null_out);
+    free(cmd);
+    return r;
+}
 
-    while (1) {
-        if (getline(&cmd, &cmd_len, stdin) == -1) break;
-        
-        if (strcmp(cmd, "q\n") == 0) break;
-        
-        if (strcmp(cmd, "a\n") == 0) {
-            editor_move_to_line_end(&ed);
-            if (editor_get_length(&ed) > 0) editor_insert_char(&ed, '\n');
-            input_mode(&ed);
-        } else if (strcmp(cmd, "i\n") == 0) {
-            editor_move_to_line_start(&ed);
-            input_mode(&ed);
-        } else if (strcmp(cmd, "p\n") == 0) {
-            print_line(&ed, editor_get_cursor(&ed));
-        } else if (strcmp(cmd, ",p\n") == 0) {
-            print_all(&ed);
-        } else if (strcmp(cmd, "d\n") == 0) {
-            size_t start = editor_find_line_start(&ed, editor_get_cursor(&ed));
-            size_t end = editor_find_line_end(&ed, editor_get_cursor(&ed));
-            size_t len = end - start;
-            if (editor_get_char(&ed, end) == '\n') len++;
-            
-            editor_move_cursor(&ed, start);
-            for (size_t i = 0; i < len; i++) editor_delete(&ed);
-        } else if (cmd[0] == 'w') {
-            char filename[256];
-            if (sscanf(cmd, "w %s", filename) == 1) {
-                if (editor_save_file(&ed, filename)) {
-                    printf("%zu\n", editor_get_length(&ed));
-                }
-            }
-        } else if (cmd[0] >= '0' && cmd[0] <= '9') {
-            int target_row = atoi(cmd);
-            editor_move_cursor(&ed, 0);
-            for (int i = 0; i < target_row; i++) {
-                editor_move_down(&ed);
-            }
-            print_line(&ed, editor_get_cursor(&ed));
+// -s sobre o arquivo mapeado. Retorna como command_loop; STREAM_BACK deixa o script no começo.
+static int stream_script(void) {
+    if (!stream_open(filename)) return STREAM_BACK;
+    cur = Stream.last;
+    int r = command_loop(stream_command, 0);
+    stream_close();
+    if (r == STREAM_BACK) {
+        rewind(input);
+        if (have_re) { regfree(&last_re); have_re = 0; }
+    }
+    return r;
+}
+
+int main(int argc, char **argv) {
+    input = stdin;
+    if (argc > 2 && strcmp(argv[1], "-s") == 0) {
+        if (!(input = fopen(argv[2], "r"))) { perror(argv[2]); return 2; }
+        script = 1;
+        argv += 2; argc -= 2;
+    }
+    if (argc > 1) snprintf(filename, sizeof(filename), "%s", argv[1]);
+    int r = script && filename[0] ? stream_script() : STREAM_BACK;
+    if (r == STREAM_BACK) {
+        if (filename[0] && editor_load_file(&ed, filename)) {
+            if (!script) printf("%zu\n", editor_get_length(&ed));
         } else {
-            if (strlen(cmd) > 1) printf("?\n");
+            editor_init(&ed, 1024);
         }
+        cur = line_count();
+        editor_set_observer(&ed, on_change, NULL);
+        size_t skip = executed;
+        executed = 0;
+        r = command_loop(run_command, skip);
     }
 
-    free(cmd);
+    if (input != stdin) fclose(input);
+    free(scratch);
+    free(Global.pos);
+    free(Batch.text);
+    free(Batch.pieces);
+    if (have_re) regfree(&last_re);
     editor_free(&ed);
-    return 0;
-}
\ No newline at end of file
+    return script && r != 1;
+}
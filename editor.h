@@ -17,23 +17,78 @@
 extern "C" {
 #endif
 
+// One edit: the text [offset, offset + removed) became [offset, offset + inserted).
+// line is the line holding offset; lines_removed / lines_inserted count the newlines
+// that left and entered the text, so lines [line, line + lines_removed] became
+// [line, line + lines_inserted].
+typedef struct {
+    size_t offset;
+    size_t removed;
+    size_t inserted;
+    size_t line;
+    size_t lines_removed;
+    size_t lines_inserted;
+} editor_change_t;
+
+// One entry of the undo log
+typedef struct {
+    int kind;      // EDITOR_UNDO_GROUP, EDITOR_UNDO_INSERT or EDITOR_UNDO_DELETE
+    size_t offset; // Where the edit happened (GROUP: cursor at editor_save_snapshot)
+    size_t len;
+    size_t data;   // DELETE: where the removed bytes start in undo_bytes
+} editor_undo_t;
+
+#define EDITOR_UNDO_GROUP  0
+#define EDITOR_UNDO_INSERT 1
+#define EDITOR_UNDO_DELETE 2
+
+// Called after every insert and delete, with the buffer already updated
+typedef void (*editor_observer_t)(void *udata, const editor_change_t *change);
+
 typedef struct {
     char *buffer;
     size_t capacity;
     size_t gap_start;
     size_t gap_end;
+
+    // Line index: offsets of every '\n', kept as a gap array that mirrors the text gap.
+    // [0, lines_gap_start) holds absolute offsets of newlines before the gap;
+    // [lines_gap_end, lines_capacity) holds (length - offset) of newlines after it,
+    // so edits at the cursor never have to renumber the rest of the index.
+    size_t *lines;
+    size_t lines_capacity;
+    size_t lines_gap_start;
+    size_t lines_gap_end;
+
+    // Change notification
+    editor_observer_t observer;
+    void *observer_udata;
+    // Everything changed since the last editor_take_changes, as one range:
+    // [dirty_start, dirty_start + dirty_removed) became [dirty_start, dirty_end)
+    int dirty;
+    size_t dirty_start, dirty_end, dirty_removed;
+    size_t dirty_lines_removed, dirty_lines_inserted; // Newlines removed / inserted over all edits
     
-    // Undo support (stack of content snapshots + cursor positions)
-    char **undo_stack;
-    size_t *undo_cursor_stack;
-    int undo_top;
-    int undo_capacity;
+    // Undo log: the edits made since each editor_save_snapshot, newest last.
+    // Inserts keep only their range; deletes keep the removed bytes in undo_bytes.
+    editor_undo_t *undo_log;
+    size_t undo_count, undo_capacity;
+    char *undo_bytes;
+    size_t undo_bytes_len, undo_bytes_capacity;
+    int undo_groups;    // Snapshots in the log (at most EDITOR_UNDO_LEVELS)
+    int undo_replaying; // editor_undo is applying the log: don't record
+
+    // Session image this editor was loaded from (see editor_load_image). The arrays
+    // above may point into it until they first grow; it is unmapped by editor_free.
+    void *image;
+    size_t image_size;
 } editor_t;
 
 // Initialize the editor with an initial capacity
 void editor_init(editor_t *ed, size_t initial_capacity);
 
-// Salva o estado atual para desfazer futuramente
+// Salva o estado atual para desfazer futuramente. Custa O(1): só as edições
+// seguintes são registradas.
 void editor_save_snapshot(editor_t *ed);
 
 // Desfaz a última alteração
@@ -42,18 +97,35 @@ void editor_undo(editor_t *ed);
 // Retorna uma string com o conteúdo do intervalo [start, end). O chamador deve liberar a memória.
 char* editor_get_range(const editor_t *ed, size_t start, size_t end);
 
+// Copia o intervalo [start, end) para dst (sem terminador). Retorna quantos bytes foram copiados.
+size_t editor_copy_range(const editor_t *ed, size_t start, size_t end, char *dst);
+
+// Bytes contíguos a partir de pos (até o gap ou o fim), sem copiar: *run recebe quantos.
+// O ponteiro vale até a próxima edição.
+const char *editor_segment(const editor_t *ed, size_t pos, size_t *run);
+
 // Conta o número total de linhas
 int editor_count_lines(const editor_t *ed);
 
 // Free resources used by the editor
 void editor_free(editor_t *ed);
 
+// Register fn to be called after every edit (NULL to stop). Survives editor_undo.
+void editor_set_observer(editor_t *ed, editor_observer_t fn, void *udata);
+
+// Coalesce every edit since the previous call into a single change covering all of them
+// (e.g. once per frame). Returns 0 if nothing changed.
+int editor_take_changes(editor_t *ed, editor_change_t *out);
+
 // Insert a character at the current cursor position
 void editor_insert_char(editor_t *ed, char c);
 
 // Insert a string at the current cursor position
 void editor_insert_text(editor_t *ed, const char *text);
 
+// Insert len bytes at the current cursor position in a single copy (text need not be null-terminated)
+void editor_insert_bytes(editor_t *ed, const char *text, size_t len);
+
 // Delete the character before the cursor (backspace)
 void editor_backspace(editor_t *ed);
 
@@ -101,6 +173,15 @@ size_t editor_find_line_end(const editor_t *ed, size_t pos);
 // Get current row and column (0-indexed)
 void editor_get_row_col(const editor_t *ed, size_t pos, size_t *row, size_t *col);
 
+// Number of lines (always >= 1). O(1).
+size_t editor_line_count(const editor_t *ed);
+
+// Offset of the first character of line (0-indexed). Returns the text length past the last line. O(1).
+size_t editor_line_offset(const editor_t *ed, size_t line);
+
+// Line (0-indexed) containing pos. O(log n).
+size_t editor_line_of(const editor_t *ed, size_t pos);
+
 // Navigation
 void editor_move_up(editor_t *ed);
 void editor_move_down(editor_t *ed);
@@ -115,6 +196,136 @@ void editor_move_word_prev(editor_t *ed);
 // Does NOT move the cursor.
 int editor_find(const editor_t *ed, const char *query, size_t start_pos);
 
+#define EDITOR_NOT_FOUND ((size_t)-1)
+
+// Finds the first occurrence of query (qlen bytes) that starts in [start_pos, end_pos).
+// Scans each side of the gap with memchr/memcmp. Returns the offset or EDITOR_NOT_FOUND.
+size_t editor_find_range(const editor_t *ed, const char *query, size_t qlen, size_t start_pos, size_t end_pos);
+
+// --- Diff ---
+
+// One side of a diff: the text of ed, or len bytes at text when ed is NULL
+typedef struct {
+    const editor_t *ed;
+    const char *text;
+    size_t len;
+} editor_text_t;
+
+// Lines [a_line, a_line + a_count) of a became lines [b_line, b_line + b_count) of b.
+// Lines are numbered as in the line index (the text after the last '\n' is a line too).
+typedef struct {
+    size_t a_line, a_count;
+    size_t b_line, b_count;
+} editor_hunk_t;
+
+typedef struct {
+    unsigned long long hash;
+    size_t offset, len; // len includes the '\n'
+} editor_diff_line_t;
+
+typedef struct {
+    size_t a0, a1, b0, b1;
+} editor_diff_range_t;
+
+// A line diff (linear-space Myers over line hashes). A hash and length match is
+// confirmed by comparing the bytes, so both texts must stay valid and unchanged
+// until the last editor_diff_step.
+typedef struct {
+    editor_hunk_t *hunks;        // Result, in order
+    size_t count, cap;
+    editor_text_t ta, tb;        // The two sides
+    editor_diff_line_t *a, *b;   // Every line of each side
+    size_t na, nb;
+    editor_diff_range_t *stack;  // Ranges still to split
+    size_t depth, stack_cap;
+    long *vf, *vb;
+} editor_diff_t;
+
+// Hashes both sides (one pass over each text) and prepares the diff
+void editor_diff_begin(editor_diff_t *d, editor_text_t a, editor_text_t b);
+
+// Does about budget units of work (line comparisons). Returns 1 while there is more,
+// so a host can run big diffs in slices from its idle loop.
+int editor_diff_step(editor_diff_t *d, size_t budget);
+
+// editor_diff_begin plus every step
+void editor_diff(editor_diff_t *d, editor_text_t a, editor_text_t b);
+
+void editor_diff_free(editor_diff_t *d);
+
+// Makes the text equal to text[0, len) with as few edits as it can: the common prefix
+// and suffix are kept and only the lines editor_diff finds different in between are
+// deleted and inserted. Every edit goes through the observer and the undo log, and the
+// cursor follows the text around it. Returns the number of hunks applied.
+size_t editor_sync_text(editor_t *ed, const char *text, size_t len);
+
+// Builds in out (uninitialized) the text as it was groups editor_save_snapshot calls
+// ago, or as far back as the undo log goes. Returns how many groups were undone.
+int editor_undo_state(const editor_t *ed, int groups, editor_t *out);
+
+#ifdef EDITOR_PROFILE
+// --- Profiling (define EDITOR_PROFILE before every include) ---
+
+// calls / bytes / time of one kind of operation
+typedef struct {
+    unsigned long long calls;
+    unsigned long long bytes;
+    unsigned long long ns;
+} editor_counter_t;
+
+typedef struct {
+    editor_counter_t gap_move; // editor_move_cursor shifts; bytes = distance the gap moved
+    editor_counter_t grow;     // editor_grow reallocations; bytes = new capacity
+    editor_counter_t snapshot; // editor_save_snapshot; bytes = undo log recorded by the group it closes
+    editor_counter_t search;   // editor_find_range; bytes = text scanned
+    unsigned long long get_char;
+} editor_stats_t;
+
+// Process-wide counters, shared by every editor_t
+extern editor_stats_t editor_stats;
+
+void editor_stats_reset(void);
+
+// Writes every gap move, grow, snapshot and search as a Chrome trace event
+// (chrome://tracing, Perfetto). Returns 1 on success.
+int editor_trace_open(const char *filename);
+void editor_trace_close(void);
+#endif
+
+#ifdef EDITOR_WRITEV
+// --- Output straight from the buffer (POSIX; define EDITOR_WRITEV before every include) ---
+// Both sides of the gap go to fd in one writev, repeated only for partial writes; nothing
+// is copied. Return 1, or 0 if a write failed (errno says why).
+
+// Bytes [start, end)
+int editor_write_range(const editor_t *ed, int fd, size_t start, size_t end);
+
+// Lines [first, last] (0-indexed) with their '\n'. With newline set, a line that has
+// none (the last one) gets it in the same call, as printing to a terminal expects.
+int editor_write_lines(const editor_t *ed, int fd, size_t first, size_t last, int newline);
+#endif
+
+#ifdef EDITOR_IMAGE
+// --- Session images (POSIX; define EDITOR_IMAGE before every include) ---
+// An image is the editor's memory written out as is: the text with its gap, the
+// line index and the undo log, plus an opaque blob for the host (marks, registers...).
+// Loading maps the file copy-on-write instead of reading it, so reopening costs the
+// same for 1 KB and 1 GB; pages are read as they are touched. Images are native-endian
+// and only meant for the machine that wrote them.
+
+// Writes the image atomically (temporary file + rename). src_size / src_mtime identify
+// the file the text came from; editor_load_image refuses an image whose keys differ.
+// Returns 1 on success.
+int editor_save_image(const editor_t *ed, const char *filename, unsigned long long src_size,
+                      unsigned long long src_mtime, const void *extra, size_t extra_len);
+
+// Replaces ed (uninitialized or freed) with the image. *extra points into the mapping
+// and stays valid until editor_free. Returns 0, leaving ed untouched, if the file is
+// missing, damaged or was written for other keys.
+int editor_load_image(editor_t *ed, const char *filename, unsigned long long src_size,
+                      unsigned long long src_mtime, const void **extra, size_t *extra_len);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -143,12 +354,219 @@ int editor_find(const editor_t *ed, const char *query, size_t start_pos);
 #define EDITOR_MEMMOVE(dst, src, sz) memmove(dst, src, sz)
 #endif
 
+#ifndef EDITOR_UNDO_LEVELS
+#define EDITOR_UNDO_LEVELS 32
+#endif
+
 #ifndef EDITOR_STRLEN
 #include <string.h>
 #define EDITOR_STRLEN(s) strlen(s)
 #endif
 
 #include <stdio.h>
+#include <string.h>
+
+#ifndef EDITOR_DIFF_MAX_COST
+// Rounds of the Myers search per split before settling for a good-enough split
+// instead of the shortest script (keeps very different texts from going quadratic)
+#define EDITOR_DIFF_MAX_COST 1024
+#endif
+
+#ifndef EDITOR_IMAGE_GAP
+// Free space left at the cursor in a saved image, so typing after a load doesn't
+// have to grow (and copy) the whole buffer. Costs no disk: the gap is a hole.
+#define EDITOR_IMAGE_GAP (1 << 20)
+#endif
+
+#ifdef EDITOR_PROFILE
+#include <time.h>
+
+editor_stats_t editor_stats;
+static FILE *editor_trace_file;
+static unsigned long long editor_trace_origin;
+static int editor_trace_events;
+static unsigned long long editor_group_bytes; // Undo log recorded since the last snapshot
+
+static unsigned long long editor_now_ns(void) {
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+void editor_stats_reset(void) {
+    memset(&editor_stats, 0, sizeof(editor_stats));
+}
+
+int editor_trace_open(const char *filename) {
+    editor_trace_close();
+    editor_trace_file = fopen(filename, "w");
+    if (!editor_trace_file) return 0;
+    editor_trace_origin = editor_now_ns();
+    editor_trace_events = 0;
+    fputs("[", editor_trace_file);
+    return 1;
+}
+
+void editor_trace_close(void) {
+    if (!editor_trace_file) return;
+    fputs("\n]\n", editor_trace_file);
+    fclose(editor_trace_file);
+    editor_trace_file = NULL;
+}
+
+static void editor_profile(editor_counter_t *c, const char *name, unsigned long long t0, size_t bytes) {
+    unsigned long long t1 = editor_now_ns();
+    c->calls++;
+    c->bytes += bytes;
+    c->ns += t1 - t0;
+    if (!editor_trace_file) return;
+    fprintf(editor_trace_file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1,\"args\":{\"bytes\":%zu}}",
+            editor_trace_events++ ? "," : "", name, (double)(t0 - editor_trace_origin) / 1e3, (double)(t1 - t0) / 1e3, bytes);
+}
+
+#define EDITOR_PROFILE_START()          unsigned long long editor_t0_ = editor_now_ns()
+#define EDITOR_PROFILE_STOP(kind, size) editor_profile(&editor_stats.kind, #kind, editor_t0_, size)
+#define EDITOR_PROFILE_COUNT(field)     (editor_stats.field++)
+#define EDITOR_PROFILE_UNDO(size)       (editor_group_bytes += (size))
+#else
+#define EDITOR_PROFILE_START()
+#define EDITOR_PROFILE_STOP(kind, size)
+#define EDITOR_PROFILE_COUNT(field)
+#define EDITOR_PROFILE_UNDO(size)
+#endif
+
+// Frees an array unless it lives in the mapped session image
+static void editor_release(editor_t *ed, void *p) {
+    char *c = (char *)p, *img = (char *)ed->image;
+    if (img && c >= img && c < img + ed->image_size) return;
+    EDITOR_FREE(p);
+}
+
+// --- Line index helpers ---
+
+static void editor_lines_grow(editor_t *ed) {
+    size_t new_capacity = ed->lines_capacity * 2;
+    size_t *new_lines = (size_t *)EDITOR_MALLOC(sizeof(size_t) * new_capacity);
+    size_t suffix = ed->lines_capacity - ed->lines_gap_end;
+    EDITOR_MEMCPY(new_lines, ed->lines, sizeof(size_t) * ed->lines_gap_start);
+    EDITOR_MEMCPY(new_lines + new_capacity - suffix, ed->lines + ed->lines_gap_end, sizeof(size_t) * suffix);
+    editor_release(ed, ed->lines);
+    ed->lines = new_lines;
+    ed->lines_gap_end = new_capacity - suffix;
+    ed->lines_capacity = new_capacity;
+}
+
+// Record a newline inserted at offset (must be right before the text gap)
+static void editor_lines_push(editor_t *ed, size_t offset) {
+    if (ed->lines_gap_start == ed->lines_gap_end) editor_lines_grow(ed);
+    ed->lines[ed->lines_gap_start++] = offset;
+}
+
+// Index every newline in the freshly inserted bytes [from, from + len)
+static void editor_lines_scan(editor_t *ed, const char *text, size_t len, size_t from) {
+    const char *p = text, *end = text + len;
+    while ((p = (const char *)memchr(p, '\n', end - p)) != NULL) {
+        editor_lines_push(ed, from + (p - text));
+        p++;
+    }
+}
+
+// --- Change notification ---
+
+// Record an edit at offset (the buffer already reflects it)
+static void editor_changed(editor_t *ed, size_t offset, size_t removed, size_t inserted,
+                           size_t lines_removed, size_t lines_inserted) {
+    if (!ed->dirty) {
+        ed->dirty = 1;
+        ed->dirty_start = offset;
+        ed->dirty_end = offset + inserted;
+        ed->dirty_removed = removed;
+        ed->dirty_lines_removed = ed->dirty_lines_inserted = 0;
+    } else {
+        // Map the end of the pending range through this edit, then take the union
+        size_t end = ed->dirty_end, inserted_before = ed->dirty_end - ed->dirty_start;
+        if (end >= offset + removed) end = end - removed + inserted;
+        else if (end > offset) end = offset + inserted;
+        if (end < offset + inserted) end = offset + inserted;
+        size_t start = offset < ed->dirty_start ? offset : ed->dirty_start;
+        // The net growth of the whole range is the sum of the growth of each edit
+        ed->dirty_removed = (end - start) + ed->dirty_removed + removed - inserted_before - inserted;
+        ed->dirty_start = start;
+        ed->dirty_end = end;
+    }
+    ed->dirty_lines_removed += lines_removed;
+    ed->dirty_lines_inserted += lines_inserted;
+
+    if (ed->observer) {
+        editor_change_t change;
+        change.offset = offset;
+        change.removed = removed;
+        change.inserted = inserted;
+        change.line = editor_line_of(ed, offset);
+        change.lines_removed = lines_removed;
+        change.lines_inserted = lines_inserted;
+        ed->observer(ed->observer_udata, &change);
+    }
+}
+
+// --- Undo log ---
+
+// Record an edit for editor_undo. bytes holds the removed text of a DELETE.
+// Nothing is recorded before the first snapshot, since it could never be undone.
+static void editor_undo_push(editor_t *ed, int kind, size_t offset, size_t len, const char *bytes) {
+    if (ed->undo_replaying || ed->undo_groups == 0) return;
+    editor_undo_t *last = &ed->undo_log[ed->undo_count - 1];
+    int extend = 0;
+    if (kind != EDITOR_UNDO_GROUP && last->kind == kind) {
+        // Digitação contínua vira uma só inserção; deleções seguidas no mesmo lugar, uma só deleção
+        if (kind == EDITOR_UNDO_INSERT && offset == last->offset + last->len) { last->len += len; return; }
+        extend = kind == EDITOR_UNDO_DELETE && offset == last->offset;
+    }
+    if (kind == EDITOR_UNDO_DELETE) {
+        if (ed->undo_bytes_len + len > ed->undo_bytes_capacity) {
+            size_t cap = ed->undo_bytes_capacity ? ed->undo_bytes_capacity * 2 : 256;
+            if (cap < ed->undo_bytes_len + len) cap = ed->undo_bytes_len + len;
+            char *nb = (char *)EDITOR_MALLOC(cap);
+            if (ed->undo_bytes_len) EDITOR_MEMCPY(nb, ed->undo_bytes, ed->undo_bytes_len);
+            editor_release(ed, ed->undo_bytes);
+            ed->undo_bytes = nb;
+            ed->undo_bytes_capacity = cap;
+        }
+        EDITOR_MEMCPY(ed->undo_bytes + ed->undo_bytes_len, bytes, len);
+        ed->undo_bytes_len += len;
+        EDITOR_PROFILE_UNDO(len);
+        if (extend) { last->len += len; return; }
+    }
+    if (ed->undo_count == ed->undo_capacity) {
+        editor_undo_t *nl = (editor_undo_t *)EDITOR_MALLOC(sizeof(editor_undo_t) * ed->undo_capacity * 2);
+        EDITOR_MEMCPY(nl, ed->undo_log, sizeof(editor_undo_t) * ed->undo_count);
+        editor_release(ed, ed->undo_log);
+        ed->undo_log = nl;
+        ed->undo_capacity *= 2;
+    }
+    editor_undo_t *u = &ed->undo_log[ed->undo_count++];
+    EDITOR_PROFILE_UNDO(sizeof(editor_undo_t));
+    u->kind = kind;
+    u->offset = offset;
+    u->len = len;
+    u->data = ed->undo_bytes_len - (kind == EDITOR_UNDO_DELETE ? len : 0);
+}
+
+void editor_set_observer(editor_t *ed, editor_observer_t fn, void *udata) {
+    ed->observer = fn;
+    ed->observer_udata = udata;
+}
+
+int editor_take_changes(editor_t *ed, editor_change_t *out) {
+    if (!ed->dirty) return 0;
+    ed->dirty = 0;
+    out->offset = ed->dirty_start;
+    out->removed = ed->dirty_removed;
+    out->inserted = ed->dirty_end - ed->dirty_start;
+    out->line = editor_line_of(ed, ed->dirty_start);
+    out->lines_inserted = editor_line_of(ed, ed->dirty_end) - out->line;
+    out->lines_removed = out->lines_inserted + ed->dirty_lines_removed - ed->dirty_lines_inserted;
+    return 1;
+}
 
 void editor_init(editor_t *ed, size_t initial_capacity) {
     if (initial_capacity == 0) initial_capacity = 64;
@@ -156,19 +574,46 @@ void editor_init(editor_t *ed, size_t initial_capacity) {
     ed->capacity = initial_capacity;
     ed->gap_start = 0;
     ed->gap_end = initial_capacity;
+
+    // Line index
+    ed->lines_capacity = 64;
+    ed->lines = (size_t *)EDITOR_MALLOC(sizeof(size_t) * ed->lines_capacity);
+    ed->lines_gap_start = 0;
+    ed->lines_gap_end = ed->lines_capacity;
+
+    ed->observer = NULL;
+    ed->observer_udata = NULL;
+    ed->dirty = 0;
     
-    // Undo stack
-    ed->undo_capacity = 32;
-    ed->undo_stack = (char **)EDITOR_MALLOC(sizeof(char*) * ed->undo_capacity);
-    ed->undo_cursor_stack = (size_t *)EDITOR_MALLOC(sizeof(size_t) * ed->undo_capacity);
-    ed->undo_top = -1;
+    // Undo log
+    ed->undo_capacity = 64;
+    ed->undo_log = (editor_undo_t *)EDITOR_MALLOC(sizeof(editor_undo_t) * ed->undo_capacity);
+    ed->undo_count = 0;
+    ed->undo_bytes = NULL;
+    ed->undo_bytes_len = ed->undo_bytes_capacity = 0;
+    ed->undo_groups = 0;
+    ed->undo_replaying = 0;
+    ed->image = NULL;
+    ed->image_size = 0;
 }
 
+#ifdef EDITOR_IMAGE
+static void editor_unmap(void *image, size_t size);
+#endif
+
 void editor_free(editor_t *ed) {
-    EDITOR_FREE(ed->buffer);
-    for (int i = 0; i <= ed->undo_top; i++) EDITOR_FREE(ed->undo_stack[i]);
-    EDITOR_FREE(ed->undo_stack);
-    EDITOR_FREE(ed->undo_cursor_stack);
+    editor_release(ed, ed->buffer);
+    editor_release(ed, ed->lines);
+    ed->lines = NULL;
+    editor_release(ed, ed->undo_log);
+    editor_release(ed, ed->undo_bytes);
+#ifdef EDITOR_IMAGE
+    if (ed->image) editor_unmap(ed->image, ed->image_size);
+#endif
+    ed->image = NULL;
+    ed->image_size = 0;
+    ed->undo_log = NULL;
+    ed->undo_bytes = NULL;
     ed->buffer = NULL;
     ed->capacity = 0;
     ed->gap_start = 0;
@@ -176,63 +621,97 @@ void editor_free(editor_t *ed) {
 }
 
 void editor_save_snapshot(editor_t *ed) {
-    if (ed->undo_top + 1 >= ed->undo_capacity) {
-        // Remove a base se estiver cheio (LIFO)
-        EDITOR_FREE(ed->undo_stack[0]);
-        for (int i = 0; i < ed->undo_top; i++) {
-            ed->undo_stack[i] = ed->undo_stack[i+1];
-            ed->undo_cursor_stack[i] = ed->undo_cursor_stack[i+1];
+    EDITOR_PROFILE_START();
+    if (ed->undo_groups == EDITOR_UNDO_LEVELS) {
+        // Esquece o grupo mais antigo (o log sempre começa por um grupo)
+        size_t drop = 1, bytes = ed->undo_bytes_len;
+        while (drop < ed->undo_count && ed->undo_log[drop].kind != EDITOR_UNDO_GROUP) drop++;
+        for (size_t i = drop; i < ed->undo_count; i++) {
+            if (ed->undo_log[i].kind == EDITOR_UNDO_DELETE) { bytes = ed->undo_log[i].data; break; }
         }
-    } else {
-        ed->undo_top++;
+        if (bytes) EDITOR_MEMMOVE(ed->undo_bytes, ed->undo_bytes + bytes, ed->undo_bytes_len - bytes);
+        ed->undo_bytes_len -= bytes;
+        EDITOR_MEMMOVE(ed->undo_log, ed->undo_log + drop, sizeof(editor_undo_t) * (ed->undo_count - drop));
+        ed->undo_count -= drop;
+        for (size_t i = 0; i < ed->undo_count; i++) {
+            if (ed->undo_log[i].kind == EDITOR_UNDO_DELETE) ed->undo_log[i].data -= bytes;
+        }
+        ed->undo_groups--;
     }
-    ed->undo_stack[ed->undo_top] = editor_to_string(ed);
-    ed->undo_cursor_stack[ed->undo_top] = editor_get_cursor(ed);
+    ed->undo_groups++;
+#ifdef EDITOR_PROFILE
+    EDITOR_PROFILE_STOP(snapshot, editor_group_bytes);
+    editor_group_bytes = 0;
+#endif
+    editor_undo_push(ed, EDITOR_UNDO_GROUP, editor_get_cursor(ed), 0, NULL);
 }
 
 void editor_undo(editor_t *ed) {
-    if (ed->undo_top < 0) return;
+    if (ed->undo_groups == 0) return;
     
-    char *text = ed->undo_stack[ed->undo_top];
-    size_t saved_cursor = ed->undo_cursor_stack[ed->undo_top];
-    ed->undo_top--;
-
-    size_t len = EDITOR_STRLEN(text);
-    
-    EDITOR_FREE(ed->buffer);
-    ed->buffer = (char *)EDITOR_MALLOC(len + 64);
-    ed->capacity = len + 64;
-    EDITOR_MEMCPY(ed->buffer, text, len);
-    ed->gap_start = len;
-    ed->gap_end = ed->capacity;
+    // Desfaz as edições do último grupo, da mais nova para a mais antiga
+    size_t saved_cursor = 0;
+    ed->undo_replaying = 1;
+    while (ed->undo_count > 0) {
+        editor_undo_t u = ed->undo_log[--ed->undo_count];
+        if (u.kind == EDITOR_UNDO_GROUP) { saved_cursor = u.offset; break; }
+        if (u.kind == EDITOR_UNDO_INSERT) {
+            editor_delete_range(ed, u.offset, u.offset + u.len);
+        } else {
+            editor_move_cursor(ed, u.offset);
+            editor_insert_bytes(ed, ed->undo_bytes + u.data, u.len);
+            ed->undo_bytes_len = u.data;
+        }
+    }
+    ed->undo_replaying = 0;
+    ed->undo_groups--;
     
     // Agora movemos o cursor para a posição salva
     editor_move_cursor(ed, saved_cursor);
-    
-    EDITOR_FREE(text);
 }
 
 char* editor_get_range(const editor_t *ed, size_t start, size_t end) {
     if (start >= end) return NULL;
     size_t len = end - start;
     char *res = (char*)EDITOR_MALLOC(len + 1);
-    for (size_t i = 0; i < len; i++) {
-        res[i] = editor_get_char(ed, start + i);
-    }
+    len = editor_copy_range(ed, start, end, res);
     res[len] = '\0';
     return res;
 }
 
-int editor_count_lines(const editor_t *ed) {
-    int lines = 1;
-    size_t len = editor_get_length(ed);
-    for (size_t i = 0; i < len; i++) {
-        if (editor_get_char(ed, i) == '\n') lines++;
+const char *editor_segment(const editor_t *ed, size_t pos, size_t *run) {
+    if (pos < ed->gap_start) { *run = ed->gap_start - pos; return ed->buffer + pos; }
+    *run = ed->capacity - (pos + ed->gap_end - ed->gap_start);
+    return ed->buffer + pos + (ed->gap_end - ed->gap_start);
+}
+
+size_t editor_copy_range(const editor_t *ed, size_t start, size_t end, char *dst) {
+    size_t length = editor_get_length(ed);
+    if (end > length) end = length;
+    if (start >= end) return 0;
+    size_t n = 0;
+    // Parte antes do gap
+    if (start < ed->gap_start) {
+        size_t stop = end < ed->gap_start ? end : ed->gap_start;
+        EDITOR_MEMCPY(dst, ed->buffer + start, stop - start);
+        n = stop - start;
+        start = stop;
     }
-    return lines;
+    // Parte depois do gap
+    if (start < end) {
+        size_t gap = ed->gap_end - ed->gap_start;
+        EDITOR_MEMCPY(dst + n, ed->buffer + start + gap, end - start);
+        n += end - start;
+    }
+    return n;
+}
+
+int editor_count_lines(const editor_t *ed) {
+    return (int)editor_line_count(ed);
 }
 
 static void editor_grow(editor_t *ed, size_t min_extra) {
+    EDITOR_PROFILE_START();
     size_t current_gap_size = ed->gap_end - ed->gap_start;
     size_t new_capacity = ed->capacity * 2;
     if (new_capacity < ed->capacity + min_extra) {
@@ -249,15 +728,19 @@ static void editor_grow(editor_t *ed, size_t min_extra) {
     size_t new_gap_end = new_capacity - suffix_len;
     EDITOR_MEMCPY(new_buffer + new_gap_end, ed->buffer + ed->gap_end, suffix_len);
     
-    EDITOR_FREE(ed->buffer);
+    editor_release(ed, ed->buffer);
     ed->buffer = new_buffer;
     ed->capacity = new_capacity;
     ed->gap_end = new_gap_end;
+    EDITOR_PROFILE_STOP(grow, new_capacity);
 }
 
 void editor_move_cursor(editor_t *ed, size_t pos) {
     size_t length = editor_get_length(ed);
     if (pos > length) pos = length;
+    if (pos == ed->gap_start) return;
+    EDITOR_PROFILE_START();
+    size_t from = ed->gap_start;
 
     if (pos < ed->gap_start) {
         // Move gap left
@@ -265,13 +748,22 @@ void editor_move_cursor(editor_t *ed, size_t pos) {
         EDITOR_MEMMOVE(ed->buffer + ed->gap_end - dist, ed->buffer + pos, dist);
         ed->gap_start -= dist;
         ed->gap_end -= dist;
+        // Newlines that crossed the gap switch to end-relative offsets
+        while (ed->lines_gap_start > 0 && ed->lines[ed->lines_gap_start - 1] >= pos) {
+            ed->lines[--ed->lines_gap_end] = length - ed->lines[--ed->lines_gap_start];
+        }
     } else if (pos > ed->gap_start) {
         // Move gap right
         size_t dist = pos - ed->gap_start;
         EDITOR_MEMMOVE(ed->buffer + ed->gap_start, ed->buffer + ed->gap_end, dist);
         ed->gap_start += dist;
         ed->gap_end += dist;
+        while (ed->lines_gap_end < ed->lines_capacity && length - ed->lines[ed->lines_gap_end] < pos) {
+            ed->lines[ed->lines_gap_start++] = length - ed->lines[ed->lines_gap_end++];
+        }
     }
+    EDITOR_PROFILE_STOP(gap_move, pos > from ? pos - from : from - pos);
+    (void)from;
 }
 
 void editor_move_cursor_relative(editor_t *ed, int offset) {
@@ -287,25 +779,46 @@ void editor_insert_char(editor_t *ed, char c) {
     if (ed->gap_start == ed->gap_end) {
         editor_grow(ed, 1);
     }
+    if (c == '\n') editor_lines_push(ed, ed->gap_start);
     ed->buffer[ed->gap_start++] = c;
+    editor_undo_push(ed, EDITOR_UNDO_INSERT, ed->gap_start - 1, 1, NULL);
+    editor_changed(ed, ed->gap_start - 1, 0, 1, 0, c == '\n');
 }
 
 void editor_insert_text(editor_t *ed, const char *text) {
-    size_t len = EDITOR_STRLEN(text);
-    for (size_t i = 0; i < len; ++i) {
-        editor_insert_char(ed, text[i]);
+    editor_insert_bytes(ed, text, EDITOR_STRLEN(text));
+}
+
+void editor_insert_bytes(editor_t *ed, const char *text, size_t len) {
+    if (len == 0) return;
+    if (ed->gap_end - ed->gap_start < len) {
+        editor_grow(ed, len);
     }
+    EDITOR_MEMCPY(ed->buffer + ed->gap_start, text, len);
+    size_t lines_before = ed->lines_gap_start;
+    editor_lines_scan(ed, text, len, ed->gap_start);
+    ed->gap_start += len;
+    editor_undo_push(ed, EDITOR_UNDO_INSERT, ed->gap_start - len, len, NULL);
+    editor_changed(ed, ed->gap_start - len, 0, len, 0, ed->lines_gap_start - lines_before);
 }
 
 void editor_backspace(editor_t *ed) {
     if (ed->gap_start > 0) {
         ed->gap_start--;
+        int newline = ed->buffer[ed->gap_start] == '\n';
+        if (newline) ed->lines_gap_start--;
+        editor_undo_push(ed, EDITOR_UNDO_DELETE, ed->gap_start, 1, ed->buffer + ed->gap_start);
+        editor_changed(ed, ed->gap_start, 1, 0, newline, 0);
     }
 }
 
 void editor_delete(editor_t *ed) {
     if (ed->gap_end < ed->capacity) {
+        int newline = ed->buffer[ed->gap_end] == '\n';
+        if (newline) ed->lines_gap_end++;
+        editor_undo_push(ed, EDITOR_UNDO_DELETE, ed->gap_start, 1, ed->buffer + ed->gap_end);
         ed->gap_end++;
+        editor_changed(ed, ed->gap_start, 1, 0, newline, 0);
     }
 }
 
@@ -319,8 +832,13 @@ void editor_delete_range(editor_t *ed, size_t start, size_t end) {
     editor_move_cursor(ed, end);
     
     // Then just expand the gap backwards to 'start'
-    size_t count = end - start;
+    size_t count = end - start, lines_before = ed->lines_gap_start;
+    editor_undo_push(ed, EDITOR_UNDO_DELETE, start, count, ed->buffer + start);
     ed->gap_start -= count;
+    while (ed->lines_gap_start > 0 && ed->lines[ed->lines_gap_start - 1] >= start) {
+        ed->lines_gap_start--;
+    }
+    editor_changed(ed, start, count, 0, lines_before - ed->lines_gap_start, 0);
 }
 
 size_t editor_get_cursor(const editor_t *ed) {
@@ -350,12 +868,9 @@ int editor_load_file(editor_t *ed, const char *filename) {
     
     if (size > 0) {
         editor_init(ed, size + 64);
-        char *temp = (char *)EDITOR_MALLOC(size);
-        fread(temp, 1, size, f);
-        for (long i = 0; i < size; i++) {
-            editor_insert_char(ed, temp[i]);
-        }
-        EDITOR_FREE(temp);
+        size_t got = fread(ed->buffer, 1, size, f);
+        editor_lines_scan(ed, ed->buffer, got, 0);
+        ed->gap_start = got;
     } else {
         editor_init(ed, 64);
     }
@@ -378,6 +893,7 @@ int editor_save_file(const editor_t *ed, const char *filename) {
 }
 
 char editor_get_char(const editor_t *ed, size_t index) {
+    EDITOR_PROFILE_COUNT(get_char);
     if (index < ed->gap_start) {
         return ed->buffer[index];
     }
@@ -388,40 +904,54 @@ char editor_get_char(const editor_t *ed, size_t index) {
     return '\0';
 }
 
+size_t editor_line_count(const editor_t *ed) {
+    return ed->lines_gap_start + (ed->lines_capacity - ed->lines_gap_end) + 1;
+}
+
+// Offset of the n-th newline (0-indexed, n < editor_line_count - 1)
+static size_t editor_newline_at(const editor_t *ed, size_t n) {
+    if (n < ed->lines_gap_start) return ed->lines[n];
+    return editor_get_length(ed) - ed->lines[ed->lines_gap_end + (n - ed->lines_gap_start)];
+}
+
+size_t editor_line_offset(const editor_t *ed, size_t line) {
+    if (line == 0) return 0;
+    if (line >= editor_line_count(ed)) return editor_get_length(ed);
+    return editor_newline_at(ed, line - 1) + 1;
+}
+
+size_t editor_line_of(const editor_t *ed, size_t pos) {
+    // Count newlines strictly before pos
+    size_t lo = 0, hi = editor_line_count(ed) - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (editor_newline_at(ed, mid) < pos) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
 size_t editor_find_line_start(const editor_t *ed, size_t pos) {
     if (pos == 0) return 0;
     size_t length = editor_get_length(ed);
     if (pos > length) pos = length;
-    
-    for (size_t i = pos; i > 0; --i) {
-        if (editor_get_char(ed, i - 1) == '\n') {
-            return i;
-        }
-    }
-    return 0;
+    return editor_line_offset(ed, editor_line_of(ed, pos));
 }
 
 size_t editor_find_line_end(const editor_t *ed, size_t pos) {
     size_t length = editor_get_length(ed);
-    for (size_t i = pos; i < length; ++i) {
-        if (editor_get_char(ed, i) == '\n') {
-            return i;
-        }
-    }
-    return length;
+    if (pos >= length) return length;
+    size_t line = editor_line_of(ed, pos);
+    if (line + 1 >= editor_line_count(ed)) return length;
+    return editor_newline_at(ed, line);
 }
 
 void editor_get_row_col(const editor_t *ed, size_t pos, size_t *row, size_t *col) {
-    size_t r = 0;
-    size_t last_line_start = 0;
-    for (size_t i = 0; i < pos; ++i) {
-        if (editor_get_char(ed, i) == '\n') {
-            r++;
-            last_line_start = i + 1;
-        }
-    }
+    size_t length = editor_get_length(ed);
+    if (pos > length) pos = length;
+    size_t r = editor_line_of(ed, pos);
     if (row) *row = r;
-    if (col) *col = pos - last_line_start;
+    if (col) *col = pos - editor_line_offset(ed, r);
 }
 
 void editor_move_to_line_start(editor_t *ed) {
@@ -547,21 +1077,504 @@ void editor_move_down(editor_t *ed) {
 }
 
 int editor_find(const editor_t *ed, const char *query, size_t start_pos) {
-    size_t qlen = EDITOR_STRLEN(query);
+    size_t pos = editor_find_range(ed, query, EDITOR_STRLEN(query), start_pos, editor_get_length(ed));
+    return pos == EDITOR_NOT_FOUND ? -1 : (int)pos;
+}
+
+// Candidates [from, to) of a contiguous segment; every candidate fits in the segment
+static size_t editor_scan(const char *text, size_t from, size_t to, const char *query, size_t qlen) {
+    while (from < to) {
+        const char *p = (const char *)memchr(text + from, query[0], to - from);
+        if (!p) break;
+        if (memcmp(p + 1, query + 1, qlen - 1) == 0) return (size_t)(p - text);
+        from = (size_t)(p - text) + 1;
+    }
+    return EDITOR_NOT_FOUND;
+}
+
+static size_t editor_find_in(const editor_t *ed, const char *query, size_t qlen, size_t start_pos, size_t end_pos) {
     size_t length = editor_get_length(ed);
-    if (qlen == 0 || start_pos >= length) return -1;
-    
-    for (size_t i = start_pos; i <= length - qlen; ++i) {
-        int match = 1;
-        for (size_t j = 0; j < qlen; ++j) {
-            if (editor_get_char(ed, i + j) != query[j]) {
-                match = 0;
-                break;
+    if (qlen == 0 || qlen > length) return EDITOR_NOT_FOUND;
+    if (end_pos > length - qlen + 1) end_pos = length - qlen + 1;
+    if (start_pos >= end_pos) return EDITOR_NOT_FOUND;
+
+    size_t gs = ed->gap_start, gap = ed->gap_end - ed->gap_start;
+    size_t before = gs >= qlen ? gs - qlen + 1 : 0; // Matches starting here end before the gap
+    size_t pos;
+
+    if (start_pos < before) {
+        pos = editor_scan(ed->buffer, start_pos, end_pos < before ? end_pos : before, query, qlen);
+        if (pos != EDITOR_NOT_FOUND) return pos;
+    }
+    // Matches that straddle the gap
+    for (size_t i = start_pos > before ? start_pos : before; i < end_pos && i < gs; ++i) {
+        size_t j = 0;
+        while (j < qlen && editor_get_char(ed, i + j) == query[j]) ++j;
+        if (j == qlen) return i;
+    }
+    size_t from = start_pos > gs ? start_pos : gs;
+    if (from < end_pos) return editor_scan(ed->buffer + gap, from, end_pos, query, qlen);
+    return EDITOR_NOT_FOUND;
+}
+
+size_t editor_find_range(const editor_t *ed, const char *query, size_t qlen, size_t start_pos, size_t end_pos) {
+    EDITOR_PROFILE_START();
+    size_t pos = editor_find_in(ed, query, qlen, start_pos, end_pos);
+#ifdef EDITOR_PROFILE
+    size_t stop = pos != EDITOR_NOT_FOUND ? pos : end_pos < editor_get_length(ed) ? end_pos : editor_get_length(ed);
+    EDITOR_PROFILE_STOP(search, stop > start_pos ? stop - start_pos : 0);
+#endif
+    return pos;
+}
+
+// --- Diff ---
+
+// Bytes shared by the start of the text and text[0, len)
+static size_t editor_common_prefix(const editor_t *ed, const char *text, size_t len) {
+    size_t n = editor_get_length(ed), i = 0, run;
+    if (len < n) n = len;
+    while (i < n) {
+        const char *seg = editor_segment(ed, i, &run);
+        if (run > n - i) run = n - i;
+        size_t j = 0;
+        while (j + 64 <= run && memcmp(seg + j, text + i + j, 64) == 0) j += 64;
+        while (j < run && seg[j] == text[i + j]) j++;
+        i += j;
+        if (j < run) break;
+    }
+    return i;
+}
+
+// Bytes shared by the end of the text and text[0, len), at most limit
+static size_t editor_common_suffix(const editor_t *ed, const char *text, size_t len, size_t limit) {
+    size_t n = editor_get_length(ed), i = 0;
+    while (i < limit) {
+        // Segment that ends at n - i, walked backwards
+        size_t end = n - i, start = end > ed->gap_start ? ed->gap_start : 0;
+        const char *seg = end > ed->gap_start ? ed->buffer + (ed->gap_end - ed->gap_start) : ed->buffer;
+        if (end - start > limit - i) start = end - (limit - i);
+        size_t j = end;
+        while (j >= start + 64 && memcmp(seg + j - 64, text + len - (n - j) - 64, 64) == 0) j -= 64;
+        while (j > start && seg[j - 1] == text[len - (n - j) - 1]) j--;
+        i += end - j;
+        if (j > start) break;
+    }
+    return i;
+}
+
+// Hash and position of every line of one side. Lines are cut as in the line index:
+// each keeps its '\n' and the text after the last '\n' is a line too (maybe empty).
+static editor_diff_line_t *editor_diff_hash(editor_text_t t, size_t *count) {
+    size_t len = t.ed ? editor_get_length(t.ed) : t.len, n = 1;
+    if (t.ed) n = editor_line_count(t.ed);
+    else for (const char *p = t.text; (p = (const char *)memchr(p, '\n', (size_t)(t.text + len - p))) != NULL; p++) n++;
+    editor_diff_line_t *lines = (editor_diff_line_t *)EDITOR_MALLOC(sizeof(editor_diff_line_t) * n);
+    unsigned long long h = 1469598103934665603ULL;
+    size_t line = 0, start = 0, pos = 0;
+    while (pos < len) {
+        size_t run = len - pos;
+        const char *seg = t.ed ? editor_segment(t.ed, pos, &run) : t.text + pos;
+        if (run > len - pos) run = len - pos;
+        for (size_t i = 0; i < run; i++) {
+            h = (h ^ (unsigned char)seg[i]) * 1099511628211ULL;
+            if (seg[i] != '\n') continue;
+            lines[line].hash = h; lines[line].offset = start; lines[line].len = pos + i + 1 - start;
+            line++; start = pos + i + 1; h = 1469598103934665603ULL;
+        }
+        pos += run;
+    }
+    lines[line].hash = h; lines[line].offset = start; lines[line].len = len - start;
+    *count = line + 1;
+    return lines;
+}
+
+// Up to len bytes of t starting at pos, contiguous
+static const char *editor_diff_bytes(editor_text_t t, size_t pos, size_t *run) {
+    if (!t.ed) { *run = t.len - pos; return t.text + pos; }
+    return editor_segment(t.ed, pos, run);
+}
+
+// Equal hashes only say the lines may be equal: the bytes decide
+static int editor_diff_eq(const editor_diff_t *d, size_t x, size_t y) {
+    const editor_diff_line_t *la = &d->a[x], *lb = &d->b[y];
+    if (la->hash != lb->hash || la->len != lb->len) return 0;
+    for (size_t done = 0, ra, rb; done < la->len; ) {
+        const char *pa = editor_diff_bytes(d->ta, la->offset + done, &ra);
+        const char *pb = editor_diff_bytes(d->tb, lb->offset + done, &rb);
+        size_t n = la->len - done;
+        if (n > ra) n = ra;
+        if (n > rb) n = rb;
+        if (memcmp(pa, pb, n) != 0) return 0;
+        done += n;
+    }
+    return 1;
+}
+
+// Appends a hunk, merging it with the previous one when they touch
+static void editor_diff_emit(editor_diff_t *d, size_t a0, size_t a1, size_t b0, size_t b1) {
+    if (a0 == a1 && b0 == b1) return;
+    editor_hunk_t *last = d->count ? &d->hunks[d->count - 1] : NULL;
+    if (last && last->a_line + last->a_count == a0 && last->b_line + last->b_count == b0) {
+        last->a_count += a1 - a0; last->b_count += b1 - b0;
+        return;
+    }
+    if (d->count == d->cap) {
+        size_t cap = d->cap ? d->cap * 2 : 16;
+        editor_hunk_t *nh = (editor_hunk_t *)EDITOR_MALLOC(sizeof(editor_hunk_t) * cap);
+        if (d->count) EDITOR_MEMCPY(nh, d->hunks, sizeof(editor_hunk_t) * d->count);
+        EDITOR_FREE(d->hunks);
+        d->hunks = nh; d->cap = cap;
+    }
+    editor_hunk_t *h = &d->hunks[d->count++];
+    h->a_line = a0; h->a_count = a1 - a0; h->b_line = b0; h->b_count = b1 - b0;
+}
+
+static void editor_diff_push(editor_diff_t *d, size_t a0, size_t a1, size_t b0, size_t b1) {
+    if (d->depth == d->stack_cap) {
+        size_t cap = d->stack_cap ? d->stack_cap * 2 : 32;
+        editor_diff_range_t *ns = (editor_diff_range_t *)EDITOR_MALLOC(sizeof(editor_diff_range_t) * cap);
+        if (d->depth) EDITOR_MEMCPY(ns, d->stack, sizeof(editor_diff_range_t) * d->depth);
+        EDITOR_FREE(d->stack);
+        d->stack = ns; d->stack_cap = cap;
+    }
+    editor_diff_range_t *r = &d->stack[d->depth++];
+    r->a0 = a0; r->a1 = a1; r->b0 = b0; r->b1 = b1;
+}
+
+// Linear-space Myers: runs the forward and backward searches until they meet and
+// returns a point of the shortest edit script, which splits the range in two.
+// Past EDITOR_DIFF_MAX_COST rounds it settles for the furthest forward point, unless
+// no line matched at all. Returns 0 if there is no useful split (the caller then
+// replaces the whole range).
+static int editor_diff_split(editor_diff_t *d, size_t a0, size_t a1, size_t b0, size_t b1,
+                             size_t *sx, size_t *sy, size_t *work) {
+    long n = (long)(a1 - a0), m = (long)(b1 - b0), max_d = (n + m + 1) / 2;
+    if (max_d > EDITOR_DIFF_MAX_COST) max_d = EDITOR_DIFF_MAX_COST;
+    long off = max_d + 1, vlen = 2 * max_d + 3, delta = n - m;
+    long *vf = d->vf, *vb = d->vb;
+    for (long i = 0; i < vlen; i++) vf[i] = vb[i] = -1;
+    vf[off + 1] = vb[off + 1] = 0;
+    int front = (delta & 1) != 0;
+    long k1s = 0, k1e = 0, k2s = 0, k2e = 0, best_x = 0, best_y = 0;
+    size_t matched = 0;
+    for (long r = 0; r < max_d; r++) {
+        for (long k = -r + k1s; k <= r - k1e; k += 2) {
+            long x = (k == -r || (k != r && vf[off + k - 1] < vf[off + k + 1])) ? vf[off + k + 1] : vf[off + k - 1] + 1;
+            long y = x - k;
+            while (x < n && y < m && editor_diff_eq(d, a0 + (size_t)x, b0 + (size_t)y)) { x++; y++; matched++; }
+            *work += 1;
+            vf[off + k] = x;
+            if (x > n) k1e += 2;
+            else if (y > m) k1s += 2;
+            else {
+                if (x + y > best_x + best_y) { best_x = x; best_y = y; }
+                long kb = off + delta - k;
+                if (front && kb >= 0 && kb < vlen && vb[kb] != -1 && x >= n - vb[kb]) {
+                    *sx = a0 + (size_t)x; *sy = b0 + (size_t)y;
+                    return 1;
+                }
             }
         }
-        if (match) return (int)i;
+        for (long k = -r + k2s; k <= r - k2e; k += 2) {
+            long x = (k == -r || (k != r && vb[off + k - 1] < vb[off + k + 1])) ? vb[off + k + 1] : vb[off + k - 1] + 1;
+            long y = x - k;
+            while (x < n && y < m && editor_diff_eq(d, a1 - 1 - (size_t)x, b1 - 1 - (size_t)y)) { x++; y++; matched++; }
+            *work += 1;
+            vb[off + k] = x;
+            if (x > n) k2e += 2;
+            else if (y > m) k2s += 2;
+            else if (!front) {
+                long kf = off + delta - k;
+                if (kf >= 0 && kf < vlen && vf[kf] != -1) {
+                    long fx = vf[kf], fy = fx - (kf - off);
+                    if (fx >= n - x) { *sx = a0 + (size_t)fx; *sy = b0 + (size_t)fy; return 1; }
+                }
+            }
+        }
+        *work += (size_t)r;
     }
-    return -1;
+    if (!matched || best_x + best_y == 0 || (best_x == n && best_y == m)) return 0;
+    *sx = a0 + (size_t)best_x; *sy = b0 + (size_t)best_y;
+    return 1;
+}
+
+void editor_diff_begin(editor_diff_t *d, editor_text_t a, editor_text_t b) {
+    memset(d, 0, sizeof(*d));
+    d->ta = a; d->tb = b;
+    d->a = editor_diff_hash(a, &d->na);
+    d->b = editor_diff_hash(b, &d->nb);
+    d->vf = (long *)EDITOR_MALLOC(sizeof(long) * (2 * EDITOR_DIFF_MAX_COST + 3));
+    d->vb = (long *)EDITOR_MALLOC(sizeof(long) * (2 * EDITOR_DIFF_MAX_COST + 3));
+    editor_diff_push(d, 0, d->na, 0, d->nb);
+}
+
+int editor_diff_step(editor_diff_t *d, size_t budget) {
+    size_t work = 0;
+    // The left half is pushed last, so hunks come out in order
+    while (d->depth > 0 && work < budget) {
+        editor_diff_range_t r = d->stack[--d->depth];
+        while (r.a0 < r.a1 && r.b0 < r.b1 && editor_diff_eq(d, r.a0, r.b0)) { r.a0++; r.b0++; work++; }
+        while (r.a0 < r.a1 && r.b0 < r.b1 && editor_diff_eq(d, r.a1 - 1, r.b1 - 1)) { r.a1--; r.b1--; work++; }
+        size_t sx, sy;
+        if (r.a0 == r.a1 || r.b0 == r.b1 || !editor_diff_split(d, r.a0, r.a1, r.b0, r.b1, &sx, &sy, &work)) {
+            editor_diff_emit(d, r.a0, r.a1, r.b0, r.b1);
+            continue;
+        }
+        editor_diff_push(d, sx, r.a1, sy, r.b1);
+        editor_diff_push(d, r.a0, sx, r.b0, sy);
+    }
+    return d->depth > 0;
+}
+
+void editor_diff(editor_diff_t *d, editor_text_t a, editor_text_t b) {
+    editor_diff_begin(d, a, b);
+    while (editor_diff_step(d, (size_t)-1)) {}
 }
 
+void editor_diff_free(editor_diff_t *d) {
+    EDITOR_FREE(d->hunks); EDITOR_FREE(d->a); EDITOR_FREE(d->b);
+    EDITOR_FREE(d->stack); EDITOR_FREE(d->vf); EDITOR_FREE(d->vb);
+    memset(d, 0, sizeof(*d));
+}
+
+size_t editor_sync_text(editor_t *ed, const char *text, size_t len) {
+    size_t n = editor_get_length(ed);
+    size_t pre = editor_common_prefix(ed, text, len);
+    if (pre == n && pre == len) return 0;
+    // Only whole lines go through the diff
+    while (pre > 0 && text[pre - 1] != '\n') pre--;
+    size_t limit = (n < len ? n : len) - pre;
+    size_t suf = editor_common_suffix(ed, text, len, limit);
+    while (suf > 0 && suf < len && text[len - suf - 1] != '\n') suf--;
+
+    // The old middle is copied out, since the edits below change the text under it
+    size_t a_len = n - suf - pre, b_len = len - suf - pre;
+    char *a_text = (char *)EDITOR_MALLOC(a_len ? a_len : 1);
+    editor_copy_range(ed, pre, n - suf, a_text);
+    editor_text_t a = { NULL, a_text, a_len }, b = { NULL, text + pre, b_len };
+    editor_diff_t d;
+    editor_diff(&d, a, b);
+
+    // From the last hunk back, so the offsets before each one stay valid
+    size_t cursor = editor_get_cursor(ed);
+    for (size_t i = d.count; i-- > 0;) {
+        const editor_hunk_t *h = &d.hunks[i];
+        size_t from = pre + d.a[h->a_line].offset;
+        size_t to = h->a_line + h->a_count < d.na ? pre + d.a[h->a_line + h->a_count].offset : pre + a_len;
+        size_t bs = d.b[h->b_line].offset;
+        size_t be = h->b_line + h->b_count < d.nb ? d.b[h->b_line + h->b_count].offset : b_len;
+        if (from < to) editor_delete_range(ed, from, to);
+        if (bs < be) { editor_move_cursor(ed, from); editor_insert_bytes(ed, text + pre + bs, be - bs); }
+        if (cursor >= to) cursor = cursor - (to - from) + (be - bs);
+        else if (cursor > from) cursor = from;
+    }
+    editor_move_cursor(ed, cursor);
+    size_t hunks = d.count;
+    editor_diff_free(&d);
+    EDITOR_FREE(a_text);
+    return hunks;
+}
+
+int editor_undo_state(const editor_t *ed, int groups, editor_t *out) {
+    editor_init(out, editor_get_length(ed) + 64);
+    editor_insert_bytes(out, ed->buffer, ed->gap_start);
+    editor_insert_bytes(out, ed->buffer + ed->gap_end, ed->capacity - ed->gap_end);
+    // Same walk as editor_undo, on the copy (which has no log of its own)
+    int done = 0;
+    for (size_t i = ed->undo_count; i > 0 && done < groups;) {
+        const editor_undo_t *u = &ed->undo_log[--i];
+        if (u->kind == EDITOR_UNDO_GROUP) done++;
+        else if (u->kind == EDITOR_UNDO_INSERT) editor_delete_range(out, u->offset, u->offset + u->len);
+        else { editor_move_cursor(out, u->offset); editor_insert_bytes(out, ed->undo_bytes + u->data, u->len); }
+    }
+    editor_move_cursor(out, 0);
+    return done;
+}
+
+#ifdef EDITOR_WRITEV
+// --- Output straight from the buffer ---
+#include <errno.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static int editor_writev(int fd, struct iovec *iov, int n) {
+    while (n > 0) {
+        ssize_t w = writev(fd, iov, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return 0;
+        for (; n > 0 && (size_t)w >= iov->iov_len; iov++, n--) w -= (ssize_t)iov->iov_len;
+        if (n > 0) { iov->iov_base = (char *)iov->iov_base + w; iov->iov_len -= (size_t)w; }
+    }
+    return 1;
+}
+
+static int editor_write_iov(const editor_t *ed, int fd, size_t start, size_t end, int newline) {
+    struct iovec iov[3]; // The gap splits the range at most once, plus the '\n'
+    int n = 0;
+    while (start < end) {
+        size_t run;
+        const char *seg = editor_segment(ed, start, &run);
+        if (run > end - start) run = end - start;
+        iov[n].iov_base = (void *)seg;
+        iov[n++].iov_len = run;
+        start += run;
+    }
+    if (newline) { iov[n].iov_base = (void *)"\n"; iov[n++].iov_len = 1; }
+    return editor_writev(fd, iov, n);
+}
+
+int editor_write_range(const editor_t *ed, int fd, size_t start, size_t end) {
+    size_t length = editor_get_length(ed);
+    if (end > length) end = length;
+    return editor_write_iov(ed, fd, start, end, 0);
+}
+
+int editor_write_lines(const editor_t *ed, int fd, size_t first, size_t last, int newline) {
+    size_t start = editor_line_offset(ed, first), end = editor_line_offset(ed, last + 1);
+    if (end > start && editor_get_char(ed, end - 1) == '\n') newline = 0;
+    return editor_write_iov(ed, fd, start, end, newline);
+}
+#endif
+
+#ifdef EDITOR_IMAGE
+// --- Session images ---
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define EDITOR_IMAGE_MAGIC "EDIMG1"
+
+// Every section starts at the offset recorded here; arrays keep their in-memory layout
+typedef struct {
+    char magic[8];
+    unsigned long long src_size, src_mtime;
+    size_t capacity, gap_start, gap_end;
+    size_t lines_capacity, lines_gap_start, lines_gap_end;
+    size_t undo_count, undo_capacity, undo_bytes_len;
+    int undo_groups;
+    size_t extra_len;
+    size_t buffer_at, lines_at, undo_at, undo_bytes_at, extra_at, total;
+} editor_image_header_t;
+
+static size_t editor_align(size_t n, size_t a) {
+    return (n + a - 1) / a * a;
+}
+
+static int editor_pwrite(int fd, const void *data, size_t len, size_t at) {
+    const char *p = (const char *)data;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, (off_t)at);
+        if (n <= 0) return 0;
+        p += n; at += (size_t)n; len -= (size_t)n;
+    }
+    return 1;
+}
+
+static void editor_unmap(void *image, size_t size) {
+    munmap(image, size);
+}
+
+int editor_save_image(const editor_t *ed, const char *filename, unsigned long long src_size,
+                      unsigned long long src_mtime, const void *extra, size_t extra_len) {
+    editor_image_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, EDITOR_IMAGE_MAGIC, sizeof(EDITOR_IMAGE_MAGIC));
+    h.src_size = src_size;
+    h.src_mtime = src_mtime;
+    size_t gap = ed->gap_end - ed->gap_start, suffix = ed->capacity - ed->gap_end;
+    if (gap < EDITOR_IMAGE_GAP) gap = EDITOR_IMAGE_GAP;
+    h.gap_start = ed->gap_start;
+    h.gap_end = ed->gap_start + gap;
+    h.capacity = h.gap_end + suffix;
+    h.lines_capacity = ed->lines_capacity;
+    h.lines_gap_start = ed->lines_gap_start;
+    h.lines_gap_end = ed->lines_gap_end;
+    h.undo_count = ed->undo_count;
+    h.undo_capacity = ed->undo_capacity;
+    h.undo_bytes_len = ed->undo_bytes_len;
+    h.undo_groups = ed->undo_groups;
+    h.extra_len = extra_len;
+    // The text is page-aligned so the mapping can hand it out as is
+    h.buffer_at = editor_align(sizeof(h), 4096);
+    h.lines_at = editor_align(h.buffer_at + h.capacity, 16);
+    h.undo_at = editor_align(h.lines_at + sizeof(size_t) * h.lines_capacity, 16);
+    h.undo_bytes_at = editor_align(h.undo_at + sizeof(editor_undo_t) * h.undo_capacity, 16);
+    h.extra_at = editor_align(h.undo_bytes_at + h.undo_bytes_len, 16);
+    h.total = h.extra_at + extra_len;
+
+    size_t plen = strlen(filename);
+    char *tmp = (char *)EDITOR_MALLOC(plen + 5);
+    EDITOR_MEMCPY(tmp, filename, plen);
+    EDITOR_MEMCPY(tmp + plen, ".new", 5);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int ok = fd >= 0;
+    // Gaps are never written: they stay holes in the file
+    size_t lsuffix = ed->lines_capacity - ed->lines_gap_end;
+    ok = ok && ftruncate(fd, (off_t)h.total) == 0
+            && editor_pwrite(fd, &h, sizeof(h), 0)
+            && editor_pwrite(fd, ed->buffer, ed->gap_start, h.buffer_at)
+            && editor_pwrite(fd, ed->buffer + ed->gap_end, suffix, h.buffer_at + h.gap_end)
+            && editor_pwrite(fd, ed->lines, sizeof(size_t) * ed->lines_gap_start, h.lines_at)
+            && editor_pwrite(fd, ed->lines + ed->lines_gap_end, sizeof(size_t) * lsuffix,
+                             h.lines_at + sizeof(size_t) * ed->lines_gap_end)
+            && editor_pwrite(fd, ed->undo_log, sizeof(editor_undo_t) * ed->undo_count, h.undo_at)
+            && editor_pwrite(fd, ed->undo_bytes, ed->undo_bytes_len, h.undo_bytes_at)
+            && editor_pwrite(fd, extra, extra_len, h.extra_at)
+            && fsync(fd) == 0;
+    if (fd >= 0) close(fd);
+    ok = ok && rename(tmp, filename) == 0;
+    if (!ok) unlink(tmp);
+    EDITOR_FREE(tmp);
+    return ok;
+}
+
+int editor_load_image(editor_t *ed, const char *filename, unsigned long long src_size,
+                      unsigned long long src_mtime, const void **extra, size_t *extra_len) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    editor_image_header_t h;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(h) || pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+        memcmp(h.magic, EDITOR_IMAGE_MAGIC, sizeof(EDITOR_IMAGE_MAGIC)) != 0 ||
+        h.src_size != src_size || h.src_mtime != src_mtime || h.total != (size_t)st.st_size ||
+        h.gap_start > h.gap_end || h.gap_end > h.capacity || h.buffer_at + h.capacity > h.lines_at ||
+        h.lines_gap_start > h.lines_gap_end || h.lines_gap_end > h.lines_capacity || h.lines_capacity == 0 ||
+        h.lines_at + sizeof(size_t) * h.lines_capacity > h.undo_at || h.undo_count > h.undo_capacity ||
+        h.undo_capacity == 0 || h.undo_at + sizeof(editor_undo_t) * h.undo_capacity > h.undo_bytes_at ||
+        h.undo_bytes_at + h.undo_bytes_len > h.extra_at || h.extra_at + h.extra_len != h.total) {
+        close(fd);
+        return 0;
+    }
+    // Private mapping: edits touch copies of the pages, never the image itself
+    char *map = (char *)mmap(NULL, h.total, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == (char *)MAP_FAILED) return 0;
+
+    editor_init(ed, 0);
+    EDITOR_FREE(ed->buffer);
+    EDITOR_FREE(ed->lines);
+    EDITOR_FREE(ed->undo_log);
+    ed->image = map;
+    ed->image_size = h.total;
+    ed->buffer = map + h.buffer_at;
+    ed->capacity = h.capacity;
+    ed->gap_start = h.gap_start;
+    ed->gap_end = h.gap_end;
+    ed->lines = (size_t *)(map + h.lines_at);
+    ed->lines_capacity = h.lines_capacity;
+    ed->lines_gap_start = h.lines_gap_start;
+    ed->lines_gap_end = h.lines_gap_end;
+    ed->undo_log = (editor_undo_t *)(map + h.undo_at);
+    ed->undo_count = h.undo_count;
+    ed->undo_capacity = h.undo_capacity;
+    ed->undo_bytes = h.undo_bytes_len ? map + h.undo_bytes_at : NULL;
+    ed->undo_bytes_len = ed->undo_bytes_capacity = h.undo_bytes_len;
+    ed->undo_groups = h.undo_groups;
+    *extra = map + h.extra_at;
+    *extra_len = h.extra_len;
+    return 1;
+}
+#endif
+
 #endif // EDITOR_IMPLEMENTATION
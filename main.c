@@ -1,8 +1,12 @@
+#include "tap.h" // First: tap.h sets _POSIX_C_SOURCE before any system header
+#define EDITOR_WRITEV
 #define EDITOR_IMPLEMENTATION
 #include "editor.h"
-#include "tap.h"
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+
+#define BENCH_TOLERANCE 25 // Median regression (%) the performance gate accepts
 
 void test_basic() {
     editor_t ed;
@@ -72,14 +76,191 @@ void test_search() {
     ok(editor_find(&ed, "fox", 0) == 16, "Find 'fox'");
     ok(editor_find(&ed, "lazy", 0) == 35, "Find 'lazy'");
     ok(editor_find(&ed, "cat", 0) == -1, "Should not find 'cat'");
+
+    editor_move_cursor(&ed, 18);
+    ok(editor_find(&ed, "fox", 0) == 16 && editor_find(&ed, "over", 17) == 26, "Find across and after the gap");
+    ok(editor_find_range(&ed, "o", 1, 13, 18) == 17 && editor_find_range(&ed, "fox", 3, 0, 16) == EDITOR_NOT_FOUND, "Find within a range");
     
     editor_free(&ed);
 }
 
+void test_line_index() {
+    editor_t ed;
+    editor_init(&ed, 4);
+    editor_insert_text(&ed, "one\ntwo\nthree\n\nfive");
+
+    ok(editor_line_count(&ed) == 5, "Line count follows inserted newlines");
+    ok(editor_line_offset(&ed, 2) == 8 && editor_line_offset(&ed, 4) == 15, "Line offsets");
+
+    editor_move_cursor(&ed, 5);
+    ok(editor_line_offset(&ed, 3) == 14 && editor_line_of(&ed, 14) == 3, "Offsets survive moving the gap left");
+
+    editor_insert_text(&ed, "X\nY");
+    size_t row, col;
+    editor_get_row_col(&ed, editor_get_cursor(&ed), &row, &col);
+    ok(editor_line_count(&ed) == 6 && row == 2 && col == 1, "Insert before later lines");
+
+    editor_delete_range(&ed, 3, 10);
+    char *s = editor_to_string(&ed);
+    ok(strcmp(s, "one\nthree\n\nfive") == 0 && editor_line_count(&ed) == 4, "Delete range drops indexed newlines");
+    free(s);
+
+    editor_move_cursor(&ed, 0);
+    editor_move_down(&ed);
+    editor_move_down(&ed);
+    ok(editor_get_cursor(&ed) == 10 && editor_find_line_end(&ed, 4) == 9, "Line navigation through the index");
+
+    editor_free(&ed);
+}
+
+static editor_change_t last_change;
+static int change_count;
+
+static void record_change(void *udata, const editor_change_t *change) {
+    (void)udata;
+    last_change = *change;
+    change_count++;
+}
+
+void test_change_observer() {
+    editor_t ed;
+    editor_init(&ed, 8);
+    editor_insert_text(&ed, "ab\ncd\nef");
+    editor_change_t c;
+    editor_take_changes(&ed, &c);
+    editor_set_observer(&ed, record_change, NULL);
+
+    editor_delete_range(&ed, 1, 5);
+    ok(change_count == 1 && last_change.offset == 1 && last_change.removed == 4 && last_change.inserted == 0 &&
+       last_change.line == 0 && last_change.lines_removed == 1 && last_change.lines_inserted == 0, "Delete reports its range and lines");
+
+    editor_move_cursor(&ed, 0);
+    editor_insert_text(&ed, "x\n");
+    ok(editor_take_changes(&ed, &c) && c.offset == 0 && c.removed == 5 && c.inserted == 3 &&
+       c.lines_removed == 1 && c.lines_inserted == 1 && !editor_take_changes(&ed, &c), "Edits coalesce into one change");
+
+    editor_save_snapshot(&ed);
+    editor_move_cursor(&ed, editor_get_length(&ed));
+    editor_insert_text(&ed, "!");
+    change_count = 0;
+    editor_undo(&ed);
+    ok(change_count == 1 && last_change.offset == 6 && last_change.removed == 1 && last_change.inserted == 0, "Undo reports only what differs");
+
+    editor_free(&ed);
+}
+
+void test_undo_log() {
+    editor_t ed;
+    editor_init(&ed, 8);
+    editor_insert_text(&ed, "hello world");
+
+    editor_save_snapshot(&ed);
+    editor_delete_range(&ed, 5, 11);
+    editor_save_snapshot(&ed);
+    editor_move_cursor(&ed, 0);
+    editor_insert_text(&ed, "> ");
+    editor_backspace(&ed);
+
+    editor_undo(&ed);
+    char *s = editor_to_string(&ed);
+    ok(strcmp(s, "hello") == 0 && editor_get_cursor(&ed) == 5, "Undo reverts the last group of edits");
+    free(s);
+
+    editor_undo(&ed);
+    editor_undo(&ed);
+    s = editor_to_string(&ed);
+    ok(strcmp(s, "hello world") == 0 && editor_line_count(&ed) == 1, "Undo restores deleted text");
+    free(s);
+
+    editor_free(&ed);
+}
+
+void test_diff() {
+    const char *a = "one\ntwo\nthree\nfour\nfive\n", *b = "one\nTWO\nthree\nfive\nsix\n";
+    editor_diff_t d;
+    editor_diff(&d, (editor_text_t){ NULL, a, strlen(a) }, (editor_text_t){ NULL, b, strlen(b) });
+    ok(d.count == 3 && d.hunks[0].a_line == 1 && d.hunks[0].a_count == 1 && d.hunks[0].b_count == 1 &&
+       d.hunks[1].a_line == 3 && d.hunks[1].a_count == 1 && d.hunks[1].b_count == 0 &&
+       d.hunks[2].b_line == 4 && d.hunks[2].a_count == 0 && d.hunks[2].b_count == 1, "Line diff finds changed, removed and added lines");
+    editor_diff_free(&d);
+
+    editor_t ed;
+    editor_init(&ed, 8);
+    editor_insert_text(&ed, a);
+    editor_move_cursor(&ed, 20); // "five"
+    editor_save_snapshot(&ed);
+    size_t hunks = editor_sync_text(&ed, b, strlen(b));
+    char *s = editor_to_string(&ed);
+    ok(hunks == 3 && strcmp(s, b) == 0 && editor_get_cursor(&ed) == 15, "Sync applies only the hunks and keeps the cursor");
+    free(s);
+
+    editor_t old;
+    int groups = editor_undo_state(&ed, 5, &old);
+    s = editor_to_string(&old);
+    char *cur = editor_to_string(&ed);
+    ok(groups == 1 && strcmp(s, a) == 0 && strcmp(cur, b) == 0, "Undo state rebuilds an older text on a copy");
+    free(s); free(cur);
+    editor_free(&old);
+    editor_free(&ed);
+}
+
+void test_write_lines() {
+    editor_t ed;
+    editor_init(&ed, 8);
+    editor_insert_text(&ed, "one\ntwo\nthree");
+    editor_move_cursor(&ed, 6); // Gap in the middle of "two"
+    int fds[2];
+    char buf[64] = { 0 };
+    int wrote = pipe(fds) == 0 && editor_write_lines(&ed, fds[1], 1, 2, 1) && editor_write_range(&ed, fds[1], 0, 3);
+    close(fds[1]);
+    ssize_t n = wrote ? read(fds[0], buf, sizeof(buf) - 1) : -1;
+    close(fds[0]);
+    ok(n == 13 && strcmp(buf, "two\nthree\none") == 0, "Write lines across the gap, closing the last one");
+    editor_free(&ed);
+}
+
+// Performance gate: TAP_BENCH_BASELINE=file compares each median against the
+// stored one (the first run records it)
+void test_performance() {
+    const char *baseline = getenv("TAP_BENCH_BASELINE");
+    editor_t ed;
+    editor_init(&ed, 16);
+    for (int i = 0; i < 16384; i++) editor_insert_text(&ed, "the quick brown fox jumps over the lazy dog, 0123456789\n");
+    size_t len = editor_get_length(&ed), lines = editor_line_count(&ed);
+    volatile size_t found = 0;
+
+    BENCH("typing 1K chars mid-buffer", 200, 20) {
+        editor_move_cursor(&ed, len / 2);
+        for (int i = 0; i < 1024; i++) editor_insert_char(&ed, 'x');
+        editor_delete_range(&ed, len / 2, len / 2 + 1024);
+    }
+    bench_ok(baseline, BENCH_TOLERANCE);
+
+    editor_move_cursor(&ed, len / 2);
+    BENCH("search 1MB across the gap", 50, 5) {
+        found = editor_find_range(&ed, "needle", 6, 0, len);
+    }
+    bench_ok(baseline, BENCH_TOLERANCE);
+
+    BENCH("jump to 100 lines", 50, 5) {
+        for (size_t i = 0; i < 100; i++) editor_move_cursor(&ed, editor_line_offset(&ed, (i * 7919) % lines));
+    }
+    bench_ok(baseline, BENCH_TOLERANCE);
+
+    (void)found;
+    editor_free(&ed);
+}
+
 int main() {
-    plan(13);
+    plan(33);
     test_basic();
     test_navigation();
     test_search();
+    test_line_index();
+    test_change_observer();
+    test_undo_log();
+    test_diff();
+    test_write_lines();
+    test_performance();
     return done_testing();
 }
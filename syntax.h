@@ -0,0 +1,288 @@
+/*
+ * syntax.h - STB-style table-driven syntax highlighting
+ *
+ * To use this library, do:
+ * #define SYNTAX_IMPLEMENTATION
+ * #include "syntax.h"
+ *
+ * Each language is a table (words, comment and string delimiters, flags)
+ * interpreted by one generic lexer. The lexer works one line at a time and
+ * returns the state at the end of the line (inside a block comment, inside a
+ * multi-line string...), so callers can cache that state per line and resume
+ * lexing anywhere.
+ */
+
+#ifndef SYNTAX_H
+#define SYNTAX_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Classes de token (uma por byte na saída do lexer)
+enum {
+    SYN_NORMAL = 0,
+    SYN_KEYWORD,
+    SYN_TYPE,
+    SYN_STRING,
+    SYN_NUMBER,
+    SYN_COMMENT,
+    SYN_PREPROC,
+    SYN_KEY,      // Chave de objeto JSON
+    SYN_VARIABLE, // $var no shell
+    SYN_ERROR,    // Níveis de log
+    SYN_WARN,
+    SYN_INFO,
+    SYN_COUNT
+};
+
+// Estados do lexer no fim de uma linha
+#define SYNTAX_ST_NORMAL  0
+#define SYNTAX_ST_COMMENT 1
+#define SYNTAX_ST_STRING  2 // + índice do delimitador em lang->strings
+
+// Flags de linguagem
+#define SYNTAX_PREPROC    (1 << 0) // '#' no início da linha é diretiva
+#define SYNTAX_VARS       (1 << 1) // $nome, ${...}, $1
+#define SYNTAX_KEYS       (1 << 2) // String seguida de ':' é chave
+#define SYNTAX_TIMESTAMPS (1 << 3) // Números podem conter - : . T Z (datas e horas)
+#define SYNTAX_ML_STRINGS (1 << 4) // Strings continuam na próxima linha
+
+typedef struct {
+    const char *word;
+    unsigned char cls;
+} syntax_word_t;
+
+typedef struct {
+    const char *name;
+    const char *extensions;         // Separadas por espaço, ex.: ".c .h"
+    const syntax_word_t *words;     // Terminado por {NULL, 0}
+    const char *line_comment;
+    const char *block_open;
+    const char *block_close;
+    const char *strings;            // Delimitadores de string
+    int flags;
+} syntax_lang_t;
+
+// Escolhe a linguagem pela extensão do arquivo (ou pelo shebang na primeira linha).
+// Retorna NULL se nenhuma servir.
+const syntax_lang_t *syntax_detect(const char *filename, const char *first_line, size_t len);
+
+// Analisa a linha [text, text + len) a partir do estado state. Se out não for NULL,
+// escreve a classe de cada byte em out[0..len). Retorna o estado no fim da linha.
+int syntax_lex_line(const syntax_lang_t *lang, int state, const char *text, size_t len, unsigned char *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SYNTAX_H
+
+#ifdef SYNTAX_IMPLEMENTATION
+
+#include <string.h>
+
+static const syntax_word_t syntax_c_words[] = {
+    {"if", SYN_KEYWORD}, {"else", SYN_KEYWORD}, {"for", SYN_KEYWORD}, {"while", SYN_KEYWORD},
+    {"do", SYN_KEYWORD}, {"switch", SYN_KEYWORD}, {"case", SYN_KEYWORD}, {"default", SYN_KEYWORD},
+    {"break", SYN_KEYWORD}, {"continue", SYN_KEYWORD}, {"return", SYN_KEYWORD}, {"goto", SYN_KEYWORD},
+    {"sizeof", SYN_KEYWORD}, {"typedef", SYN_KEYWORD}, {"struct", SYN_KEYWORD}, {"union", SYN_KEYWORD},
+    {"enum", SYN_KEYWORD}, {"static", SYN_KEYWORD}, {"extern", SYN_KEYWORD}, {"const", SYN_KEYWORD},
+    {"volatile", SYN_KEYWORD}, {"inline", SYN_KEYWORD}, {"register", SYN_KEYWORD}, {"restrict", SYN_KEYWORD},
+    {"class", SYN_KEYWORD}, {"namespace", SYN_KEYWORD}, {"template", SYN_KEYWORD}, {"typename", SYN_KEYWORD},
+    {"public", SYN_KEYWORD}, {"private", SYN_KEYWORD}, {"protected", SYN_KEYWORD}, {"virtual", SYN_KEYWORD},
+    {"override", SYN_KEYWORD}, {"new", SYN_KEYWORD}, {"delete", SYN_KEYWORD}, {"this", SYN_KEYWORD},
+    {"operator", SYN_KEYWORD}, {"try", SYN_KEYWORD}, {"catch", SYN_KEYWORD}, {"throw", SYN_KEYWORD},
+    {"using", SYN_KEYWORD}, {"constexpr", SYN_KEYWORD}, {"noexcept", SYN_KEYWORD}, {"friend", SYN_KEYWORD},
+    {"nullptr", SYN_NUMBER}, {"NULL", SYN_NUMBER}, {"true", SYN_NUMBER}, {"false", SYN_NUMBER},
+    {"void", SYN_TYPE}, {"char", SYN_TYPE}, {"short", SYN_TYPE}, {"int", SYN_TYPE}, {"long", SYN_TYPE},
+    {"float", SYN_TYPE}, {"double", SYN_TYPE}, {"signed", SYN_TYPE}, {"unsigned", SYN_TYPE},
+    {"bool", SYN_TYPE}, {"auto", SYN_TYPE}, {"size_t", SYN_TYPE}, {"ssize_t", SYN_TYPE},
+    {"int8_t", SYN_TYPE}, {"int16_t", SYN_TYPE}, {"int32_t", SYN_TYPE}, {"int64_t", SYN_TYPE},
+    {"uint8_t", SYN_TYPE}, {"uint16_t", SYN_TYPE}, {"uint32_t", SYN_TYPE}, {"uint64_t", SYN_TYPE},
+    {NULL, 0}
+};
+
+static const syntax_word_t syntax_sh_words[] = {
+    {"if", SYN_KEYWORD}, {"then", SYN_KEYWORD}, {"else", SYN_KEYWORD}, {"elif", SYN_KEYWORD},
+    {"fi", SYN_KEYWORD}, {"for", SYN_KEYWORD}, {"while", SYN_KEYWORD}, {"until", SYN_KEYWORD},
+    {"do", SYN_KEYWORD}, {"done", SYN_KEYWORD}, {"case", SYN_KEYWORD}, {"esac", SYN_KEYWORD},
+    {"in", SYN_KEYWORD}, {"function", SYN_KEYWORD}, {"return", SYN_KEYWORD}, {"local", SYN_KEYWORD},
+    {"export", SYN_KEYWORD}, {"readonly", SYN_KEYWORD}, {"break", SYN_KEYWORD}, {"continue", SYN_KEYWORD},
+    {"exit", SYN_KEYWORD},
+    {"echo", SYN_TYPE}, {"printf", SYN_TYPE}, {"cd", SYN_TYPE}, {"read", SYN_TYPE}, {"test", SYN_TYPE},
+    {"source", SYN_TYPE}, {"set", SYN_TYPE}, {"unset", SYN_TYPE}, {"shift", SYN_TYPE}, {"trap", SYN_TYPE},
+    {"eval", SYN_TYPE}, {"exec", SYN_TYPE},
+    {NULL, 0}
+};
+
+static const syntax_word_t syntax_json_words[] = {
+    {"true", SYN_KEYWORD}, {"false", SYN_KEYWORD}, {"null", SYN_KEYWORD},
+    {NULL, 0}
+};
+
+static const syntax_word_t syntax_log_words[] = {
+    {"FATAL", SYN_ERROR}, {"ERROR", SYN_ERROR}, {"ERR", SYN_ERROR}, {"CRITICAL", SYN_ERROR},
+    {"WARN", SYN_WARN}, {"WARNING", SYN_WARN},
+    {"INFO", SYN_INFO}, {"NOTICE", SYN_INFO}, {"DEBUG", SYN_COMMENT}, {"TRACE", SYN_COMMENT},
+    {NULL, 0}
+};
+
+static const syntax_lang_t syntax_langs[] = {
+    {"c", ".c .h .cc .cpp .cxx .hpp .hh .hxx", syntax_c_words, "//", "/*", "*/", "\"'", SYNTAX_PREPROC},
+    {"sh", ".sh .bash .zsh .ksh", syntax_sh_words, "#", NULL, NULL, "\"'`", SYNTAX_VARS | SYNTAX_ML_STRINGS},
+    {"json", ".json", syntax_json_words, NULL, NULL, NULL, "\"", SYNTAX_KEYS},
+    {"log", ".log", syntax_log_words, NULL, NULL, NULL, "\"", SYNTAX_TIMESTAMPS},
+};
+
+static int syntax_has_ext(const char *list, const char *ext, size_t len) {
+    const char *p = list;
+    while ((p = strstr(p, ext)) != NULL) {
+        if ((p == list || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) return 1;
+        p += len;
+    }
+    return 0;
+}
+
+const syntax_lang_t *syntax_detect(const char *filename, const char *first_line, size_t len) {
+    const size_t n_langs = sizeof(syntax_langs) / sizeof(syntax_langs[0]);
+    const char *dot = filename ? strrchr(filename, '.') : NULL;
+    if (dot && !strchr(dot, '/')) {
+        for (size_t i = 0; i < n_langs; i++) {
+            if (syntax_has_ext(syntax_langs[i].extensions, dot, strlen(dot))) return &syntax_langs[i];
+        }
+    }
+    // #!/bin/sh, #!/usr/bin/env bash...
+    if (first_line && len > 2 && first_line[0] == '#' && first_line[1] == '!') {
+        for (size_t i = 2; i + 1 < len && first_line[i] != '\n'; i++) {
+            if (first_line[i] == 's' && first_line[i + 1] == 'h') return &syntax_langs[1];
+        }
+    }
+    return NULL;
+}
+
+static int syntax_is_ident(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static int syntax_is_digit(unsigned char c) {
+    return c >= '0' && c <= '9';
+}
+
+static int syntax_match(const char *text, size_t len, size_t i, const char *tok) {
+    size_t n = strlen(tok);
+    return i + n <= len && memcmp(text + i, tok, n) == 0;
+}
+
+static unsigned char syntax_lookup(const syntax_lang_t *lang, const char *w, size_t n) {
+    for (const syntax_word_t *k = lang->words; k && k->word; k++) {
+        if (strlen(k->word) == n && memcmp(k->word, w, n) == 0) return k->cls;
+    }
+    return SYN_NORMAL;
+}
+
+int syntax_lex_line(const syntax_lang_t *lang, int state, const char *text, size_t len, unsigned char *out) {
+    const unsigned char *s = (const unsigned char *)text;
+    size_t i = 0, str_start = 0;
+#define SYNTAX_PAINT(from, to, cls) do { if (out) memset(out + (from), (cls), (to) - (from)); } while (0)
+
+    while (i < len) {
+        if (state == SYNTAX_ST_COMMENT) {
+            size_t j = i;
+            while (j < len && !syntax_match(text, len, j, lang->block_close)) j++;
+            if (j < len) { j += strlen(lang->block_close); state = SYNTAX_ST_NORMAL; }
+            SYNTAX_PAINT(i, j, SYN_COMMENT);
+            i = j;
+            continue;
+        }
+        if (state >= SYNTAX_ST_STRING) {
+            unsigned char d = (unsigned char)lang->strings[state - SYNTAX_ST_STRING];
+            size_t j = i;
+            while (j < len && s[j] != d) j += (s[j] == '\\' && j + 1 < len) ? 2 : 1;
+            if (j < len) {
+                j++;
+                state = SYNTAX_ST_NORMAL;
+                SYNTAX_PAINT(i, j, SYN_STRING);
+                if (lang->flags & SYNTAX_KEYS) {
+                    size_t k = j;
+                    while (k < len && (s[k] == ' ' || s[k] == '\t')) k++;
+                    if (k < len && s[k] == ':') SYNTAX_PAINT(str_start, j, SYN_KEY);
+                }
+            } else {
+                SYNTAX_PAINT(i, j, SYN_STRING);
+            }
+            i = j;
+            continue;
+        }
+
+        unsigned char c = s[i];
+        if (lang->line_comment && syntax_match(text, len, i, lang->line_comment)
+            && (c != '#' || !(lang->flags & SYNTAX_VARS) || i == 0 || s[i - 1] == ' ' || s[i - 1] == '\t')) {
+            SYNTAX_PAINT(i, len, SYN_COMMENT);
+            i = len;
+            break;
+        }
+        if (lang->block_open && syntax_match(text, len, i, lang->block_open)) {
+            size_t n = strlen(lang->block_open);
+            SYNTAX_PAINT(i, i + n, SYN_COMMENT);
+            i += n;
+            state = SYNTAX_ST_COMMENT;
+            continue;
+        }
+        const char *d = lang->strings ? strchr(lang->strings, c) : NULL;
+        if (c && d) {
+            SYNTAX_PAINT(i, i + 1, SYN_STRING);
+            str_start = i++;
+            state = SYNTAX_ST_STRING + (int)(d - lang->strings);
+            continue;
+        }
+        if ((lang->flags & SYNTAX_PREPROC) && c == '#') {
+            size_t k = 0;
+            while (k < i && (s[k] == ' ' || s[k] == '\t')) k++;
+            if (k == i) {
+                // A diretiva vai até um comentário ou o fim da linha
+                size_t j = i;
+                while (j < len && !syntax_match(text, len, j, "//") && !syntax_match(text, len, j, "/*")) j++;
+                SYNTAX_PAINT(i, j, SYN_PREPROC);
+                i = j;
+                continue;
+            }
+        }
+        if ((lang->flags & SYNTAX_VARS) && c == '$' && i + 1 < len) {
+            size_t j = i + 1;
+            if (s[j] == '{') { while (j < len && s[j] != '}') j++; if (j < len) j++; }
+            else if (syntax_is_ident(s[j])) { while (j < len && syntax_is_ident(s[j])) j++; }
+            else j++; // $?, $#, $@...
+            SYNTAX_PAINT(i, j, SYN_VARIABLE);
+            i = j;
+            continue;
+        }
+        if ((syntax_is_digit(c) || (c == '-' && i + 1 < len && syntax_is_digit(s[i + 1]) && !(lang->flags & SYNTAX_VARS)))
+            && (i == 0 || !syntax_is_ident(s[i - 1]))) {
+            size_t j = i + 1;
+            while (j < len && (syntax_is_ident(s[j]) || s[j] == '.'
+                   || ((lang->flags & SYNTAX_TIMESTAMPS) && (s[j] == ':' || s[j] == '-' || s[j] == '+')))) j++;
+            SYNTAX_PAINT(i, j, SYN_NUMBER);
+            i = j;
+            continue;
+        }
+        if (syntax_is_ident(c)) {
+            size_t j = i;
+            while (j < len && syntax_is_ident(s[j])) j++;
+            SYNTAX_PAINT(i, j, syntax_lookup(lang, text + i, j - i));
+            i = j;
+            continue;
+        }
+        SYNTAX_PAINT(i, i + 1, SYN_NORMAL);
+        i++;
+    }
+
+    // Só linguagens com strings multilinha carregam a string aberta para a próxima linha
+    if (state >= SYNTAX_ST_STRING && !(lang->flags & SYNTAX_ML_STRINGS)) state = SYNTAX_ST_NORMAL;
+#undef SYNTAX_PAINT
+    return state;
+}
+
+#endif // SYNTAX_IMPLEMENTATION
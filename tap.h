@@ -1,8 +1,15 @@
 #ifndef TAP_H
 #define TAP_H
 
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 199309L // clock_gettime under -std=c99
+#endif
+
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 static int _tap_test_count = 0;
 static int _tap_test_failed = 0;
@@ -52,4 +59,92 @@ static int done_testing() {
     return 0;
 }
 
+// --- Benchmarks ---
+// BENCH("name", runs, warmup) { body } runs the body warmup + runs times, timing
+// each run with the monotonic clock, and reports min/median/p99 as a diagnostic.
+// bench_ok() then turns the result into a test against a stored baseline.
+
+typedef struct {
+    const char *name;
+    int runs, warmup, iter;
+    long long t0;
+    long long *samples;
+} tap_bench_t;
+
+static struct {
+    char name[128];
+    long long min, median, p99;
+} _tap_bench_last;
+
+static long long _tap_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int _tap_cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static tap_bench_t _tap_bench_begin(const char *name, int runs, int warmup) {
+    tap_bench_t b = { name, runs > 0 ? runs : 1, warmup > 0 ? warmup : 0, -1, 0, NULL };
+    b.samples = (long long *)malloc(sizeof(long long) * (size_t)b.runs);
+    return b;
+}
+
+// Closes the run in progress and starts the next one. Returns 0 after the last run.
+static int _tap_bench_next(tap_bench_t *b) {
+    long long now = _tap_now_ns();
+    if (b->iter >= b->warmup) b->samples[b->iter - b->warmup] = now - b->t0;
+    b->iter++;
+    if (b->iter < b->warmup + b->runs) {
+        b->t0 = _tap_now_ns();
+        return 1;
+    }
+
+    qsort(b->samples, (size_t)b->runs, sizeof(long long), _tap_cmp_ll);
+    snprintf(_tap_bench_last.name, sizeof(_tap_bench_last.name), "%s", b->name);
+    _tap_bench_last.min = b->samples[0];
+    _tap_bench_last.median = b->samples[b->runs / 2];
+    _tap_bench_last.p99 = b->samples[(b->runs * 99) / 100];
+    diag("bench %s: min %lld ns, median %lld ns, p99 %lld ns (%d runs)", b->name,
+         _tap_bench_last.min, _tap_bench_last.median, _tap_bench_last.p99, b->runs);
+    free(b->samples);
+    return 0;
+}
+
+#define BENCH(name, runs, warmup) \
+    for (tap_bench_t _tap_b = _tap_bench_begin(name, runs, warmup); _tap_bench_next(&_tap_b); )
+
+// Fails if the median of the last BENCH is more than max_regress_pct above its
+// entry in baseline_path (one "name<TAB>median_ns" per line, the last one wins).
+// Without an entry the test is skipped and the median is appended as the baseline.
+static void bench_ok(const char *baseline_path, double max_regress_pct) {
+    const char *name = _tap_bench_last.name;
+    long long median = _tap_bench_last.median, base = -1;
+    FILE *f = baseline_path ? fopen(baseline_path, "r") : NULL;
+    if (f) {
+        char line[256];
+        while (fgets(line, sizeof(line), f)) {
+            char *tab = strrchr(line, '\t');
+            if (!tab) continue;
+            *tab = '\0';
+            if (strcmp(line, name) == 0) base = atoll(tab + 1);
+        }
+        fclose(f);
+    }
+    if (base < 0) {
+        if (baseline_path && (f = fopen(baseline_path, "a"))) {
+            fprintf(f, "%s\t%lld\n", name, median);
+            fclose(f);
+        }
+        ok(1, "bench %s # SKIP no baseline%s", name, baseline_path ? " (recorded)" : "");
+        return;
+    }
+    double pct = base > 0 ? 100.0 * (double)(median - base) / (double)base : 0.0;
+    ok(pct <= max_regress_pct, "bench %s: median %lld ns vs baseline %lld ns (%+.1f%%, limit +%.0f%%)",
+       name, median, base, pct, max_regress_pct);
+}
+
 #endif /* TAP_H */
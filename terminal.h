@@ -102,6 +102,9 @@ void term_printf_at(int x, int y, const char *fmt, ...);
 // Oculta/Mostra o cursor
 void term_cursor_show(int show);
 
+// Liga/Desliga o modo "bracketed paste" (colagens chegam entre ESC[200~ e ESC[201~)
+void term_bracketed_paste(int enable);
+
 #ifdef __cplusplus
 }
 #endif
@@ -168,4 +171,9 @@ void term_cursor_show(int show) {
     else printf("\033[?25l");
 }
 
+void term_bracketed_paste(int enable) {
+    if (enable) printf("\033[?2004h");
+    else printf("\033[?2004l");
+}
+
 #endif // TERMINAL_IMPLEMENTATION
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,29 +7,754 @@
 #include <sys/ioctl.h>
 #include <ctype.h>
 #include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <pthread.h>
+#include <math.h>
 
+// --- Estatísticas (cc -DV_STATS) ---
+// Sem V_STATS tudo isto some e STATS_TIME vira só a instrução medida
+#ifdef V_STATS
+#define EDITOR_PROFILE // Contadores de gap, crescimento, snapshots e buscas do editor.h
+#endif
+
+// --- Memória dos buffers ---
+// Tudo o que o editor.h aloca (texto, índice de linhas, desfazer) sai de um pool
+// comum a todos os buffers, para que centenas de arquivos abertos não piquem o heap.
+// Blocos até POOL_MAX são potências de 2 cortadas de páginas de POOL_PAGE bytes; um
+// bloco solto vai para a lista da sua classe e serve ao próximo pedido de qualquer
+// buffer (o editor.h só cresce dobrando, então as classes casam com os pedidos).
+// Blocos maiores são mapeados à parte e voltam ao sistema no free. Um cabeçalho
+// guarda o tamanho, porque EDITOR_FREE não o recebe. Só a thread principal aloca.
+#define POOL_MIN_SHIFT 5         // Menor bloco: 32 bytes, cabeçalho incluso
+#define POOL_CLASSES   14        // 32 B .. 256 KB
+#define POOL_MAX       ((size_t)1 << (POOL_MIN_SHIFT + POOL_CLASSES - 1))
+#define POOL_PAGE      ((size_t)1 << 20)
+#define POOL_HEADER    16        // Mantém o alinhamento de 16 do malloc
+
+static struct {
+    void *free[POOL_CLASSES]; // Listas de blocos soltos, encadeadas pelo primeiro ponteiro
+    char *page;               // Resto ainda não cortado da página atual
+    size_t left;
+    size_t pages, mapped;     // Páginas do pool e bytes em blocos grandes
+} Pool;
+
+static int pool_class(size_t size) {
+    int c = 0;
+    while (((size_t)1 << (POOL_MIN_SHIFT + c)) < size) c++;
+    return c;
+}
+
+static void pool_push(char *block, int c) {
+    *(void **)block = Pool.free[c];
+    Pool.free[c] = block;
+}
+
+static void *pool_alloc(size_t sz) {
+    size_t size = sz + POOL_HEADER;
+    char *block;
+    if (size > POOL_MAX) {
+        size = (size + 4095) & ~(size_t)4095;
+        block = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (block == MAP_FAILED) return NULL;
+        Pool.mapped += size;
+    } else {
+        int c = pool_class(size);
+        size = (size_t)1 << (POOL_MIN_SHIFT + c);
+        if ((block = Pool.free[c])) Pool.free[c] = *(void **)block;
+        else {
+            if (Pool.left < size) {
+                // O resto da página vai para as listas das classes menores
+                for (int k = c - 1; k >= 0; k--)
+                    if (Pool.left >= ((size_t)1 << (POOL_MIN_SHIFT + k))) {
+                        pool_push(Pool.page, k);
+                        Pool.page += (size_t)1 << (POOL_MIN_SHIFT + k);
+                        Pool.left -= (size_t)1 << (POOL_MIN_SHIFT + k);
+                    }
+                Pool.page = mmap(NULL, POOL_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (Pool.page == MAP_FAILED) { Pool.page = NULL; Pool.left = 0; return NULL; }
+                Pool.left = POOL_PAGE;
+                Pool.pages++;
+            }
+            block = Pool.page;
+            Pool.page += size;
+            Pool.left -= size;
+        }
+    }
+    *(size_t *)block = size;
+    return block + POOL_HEADER;
+}
+
+static void pool_free(void *p) {
+    if (!p) return;
+    char *block = (char *)p - POOL_HEADER;
+    size_t size = *(size_t *)block;
+    if (size > POOL_MAX) { munmap(block, size); Pool.mapped -= size; }
+    else pool_push(block, pool_class(size));
+}
+
+#define EDITOR_MALLOC(sz) pool_alloc(sz)
+#define EDITOR_FREE(p)    pool_free(p)
+#define EDITOR_IMAGE // Imagens de sessão (:mks)
 #define EDITOR_IMPLEMENTATION
 #include "editor.h"
 
 #define TERMINAL_IMPLEMENTATION
 #include "terminal.h"
 
+#define SYNTAX_IMPLEMENTATION
+#include "syntax.h"
+
 #define FILENAME_SIZE    256
 #define INITIAL_ED_CAP   1024
 #define POLL_TIMEOUT     50
+#define ESC_TIMEOUT      25
+#define INPUT_BUF_SIZE   65536
+#define PASTE_BEGIN      "\033[200~"
+#define PASTE_END        "\033[201~"
+#define PASTE_MARK_LEN   6
+#define PASTE_TIMEOUT    1000  // ms sem bytes que encerram uma colagem sem o ESC[201~
+#define FRAME_RATE_CAP   0     // Quadros por segundo (0 = sem limite)
+#define IDLE_SLICE_US    4000  // Fatia de tempo dada aos jobs de fundo quando não há entrada
+#define MAX_IDLE_JOBS    8
+#define FILTER_CHUNK     (1 << 20) // Bytes por chamada de vmsplice/splice nos filtros
+#define SORT_PARALLEL    (1 << 16) // Linhas a partir das quais o :sort divide o trabalho entre threads
+#define DIFF_SLICE       200000    // Comparações de linha por fatia do :diff no tempo ocioso
+#define OUTPUT_BUF_SIZE  (1 << 16)
+#define JOURNAL_MAGIC    "VSWP1\n"
+#define JOURNAL_SYNC_MS  1000      // Intervalo máximo entre fsyncs do journal
+#define JOURNAL_COMPACT  (1 << 20) // Tamanho mínimo do journal antes de compactar
+#define JOURNAL_DIRECT   (1 << 16) // Inserções a partir daqui não passam pelo buffer do journal
 
 #include "v_clone.h"
 
 typedef struct State_s {
     editor_t ed;
     v_state_t v;
-    char *clipboard;
     char filename[FILENAME_SIZE];
+    const syntax_lang_t *lang;
 } State_t;
 
 State_t State;
 struct termios orig_termios;
 
+static long long now_ns(void) {
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#ifdef V_STATS
+// Histograma log-linear (estilo HDR): 16 faixas por potência de 2, erro de ~6%
+#define HIST_SUB_BITS 4
+#define HIST_BUCKETS  (64 << HIST_SUB_BITS)
+
+typedef struct {
+    unsigned long long counts[HIST_BUCKETS];
+    unsigned long long n, sum, max;
+} hist_t;
+
+enum { ST_READ, ST_KEY, ST_RENDER, ST_FLUSH, ST_COUNT };
+static const char *stats_names[ST_COUNT] = { "read", "key", "render", "flush" };
+
+static struct {
+    hist_t hist[ST_COUNT]; // Nanossegundos por chamada
+} Stats;
+
+static int hist_bucket(unsigned long long x) {
+    if (x < (1u << HIST_SUB_BITS)) return (int)x;
+    int e = 63 - __builtin_clzll(x);
+    return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + (int)((x >> (e - HIST_SUB_BITS)) & ((1u << HIST_SUB_BITS) - 1));
+}
+
+// Menor valor que cai no bucket b
+static unsigned long long hist_value(int b) {
+    if (b < (1 << HIST_SUB_BITS)) return (unsigned long long)b;
+    int e = (b >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    return (unsigned long long)((1 << HIST_SUB_BITS) + (b & ((1 << HIST_SUB_BITS) - 1))) << (e - HIST_SUB_BITS);
+}
+
+static void hist_add(hist_t *h, long long x) {
+    if (x < 0) x = 0;
+    h->counts[hist_bucket((unsigned long long)x)]++;
+    h->n++; h->sum += (unsigned long long)x;
+    if ((unsigned long long)x > h->max) h->max = (unsigned long long)x;
+}
+
+static unsigned long long hist_percentile(const hist_t *h, double p) {
+    unsigned long long want = (unsigned long long)(p / 100.0 * (double)h->n + 0.5), seen = 0;
+    if (want == 0) want = 1;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->counts[b];
+        if (seen >= want) return hist_value(b);
+    }
+    return h->max;
+}
+
+static const char *fmt_ns(char *buf, unsigned long long ns) {
+    if (ns < 10000) snprintf(buf, 16, "%lluns", ns);
+    else if (ns < 10000000) snprintf(buf, 16, "%.1fus", ns / 1e3);
+    else snprintf(buf, 16, "%.1fms", ns / 1e6);
+    return buf;
+}
+
+static size_t stats_undo_bytes(void) {
+    return State.ed.undo_bytes_len + State.ed.undo_count * sizeof(editor_undo_t);
+}
+
+// :stats — resumo numa linha da barra de status
+static int stats_command(v_state_t *v, const char *cmd) {
+    if (strcmp(cmd, "stats") != 0) return 0;
+    char msg[256], a[16], b[16];
+    int n = snprintf(msg, sizeof(msg), "p50/p99");
+    for (int i = ST_KEY; i < ST_COUNT; i++) {
+        const hist_t *h = &Stats.hist[i];
+        n += snprintf(msg + n, sizeof(msg) - (size_t)n, " %s %s/%s", stats_names[i],
+                      fmt_ns(a, hist_percentile(h, 50)), fmt_ns(b, hist_percentile(h, 99)));
+    }
+    const editor_stats_t *e = &editor_stats;
+    snprintf(msg + n, sizeof(msg) - (size_t)n, " | gap %llu %.1fMB grows %llu undo %zuKB",
+             e->gap_move.calls, e->gap_move.bytes / 1e6, e->grow.calls, stats_undo_bytes() / 1024);
+    v_message(v, "%s", msg);
+    return 1;
+}
+
+// V_STATS_FILE=arquivo: relatório completo na saída do editor
+static void stats_dump(void) {
+    const char *path = getenv("V_STATS_FILE");
+    FILE *f = path ? fopen(path, "w") : NULL;
+    if (!f) return;
+    static const double pcts[] = { 50, 90, 99, 99.9 };
+    for (int i = 0; i < ST_COUNT; i++) {
+        const hist_t *h = &Stats.hist[i];
+        fprintf(f, "%-7s n %llu mean %lluns", stats_names[i], h->n, h->n ? h->sum / h->n : 0);
+        for (int k = 0; k < 4; k++) fprintf(f, " p%g %lluns", pcts[k], hist_percentile(h, pcts[k]));
+        fprintf(f, " max %lluns\n", h->max);
+    }
+    const editor_counter_t *c[] = { &editor_stats.gap_move, &editor_stats.grow, &editor_stats.snapshot, &editor_stats.search };
+    static const char *names[] = { "gap", "grow", "snapshot", "search" };
+    for (int i = 0; i < 4; i++) fprintf(f, "%-8s %llu calls %llu bytes %lluns\n", names[i], c[i]->calls, c[i]->bytes, c[i]->ns);
+    fprintf(f, "get_char %llu\nundo    %zu bytes\n", editor_stats.get_char, stats_undo_bytes());
+    fprintf(f, "pool    %zu pages %zu mapped bytes\n", Pool.pages, Pool.mapped);
+    fclose(f);
+}
+
+#define STATS_TIME(k, stmt) do { long long t0_ = now_ns(); stmt; hist_add(&Stats.hist[k], now_ns() - t0_); } while (0)
+#define STATS_COMMAND(v, cmd) stats_command(v, cmd)
+#else
+#define STATS_TIME(k, stmt) do { stmt; } while (0)
+#define STATS_COMMAND(v, cmd) 0
+#define stats_dump()
+#endif
+
+// Arquivo auxiliar .<nome><ext> no diretório do arquivo editado
+static void side_path(char *out, size_t size, const char *filename, const char *ext) {
+    const char *slash = strrchr(filename, '/');
+    int dir = slash ? (int)(slash - filename + 1) : 0;
+    snprintf(out, size, "%.*s.%s%s", dir, filename, filename + dir, ext);
+}
+
+// Tamanho e mtime (ns) do arquivo em disco; zeros se ele não existe
+static void file_stamp(const char *filename, unsigned long long *size, unsigned long long *mtime) {
+    struct stat st;
+    if (stat(filename, &st) != 0) { *size = *mtime = 0; return; }
+    *size = (unsigned long long)st.st_size;
+    *mtime = (unsigned long long)st.st_mtim.tv_sec * 1000000000ULL + (unsigned long long)st.st_mtim.tv_nsec;
+}
+
+// O arquivo inteiro mapeado só para leitura ("" se vazio); NULL se não deu para ler
+static char *map_file(const char *filename, size_t *len) {
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) { if (fd >= 0) close(fd); return NULL; }
+    *len = (size_t)st.st_size;
+    char *text = *len ? mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    close(fd);
+    return text == MAP_FAILED ? NULL : text;
+}
+
+static void unmap_file(char *text, size_t len) {
+    if (len) munmap(text, len);
+}
+
+// --- Journal de recuperação ---
+// Cada edição vira um registro (offset, removidos, inseridos + bytes) anexado a
+// .<arquivo>.vswp, então o custo acompanha o tamanho da edição, não o do arquivo.
+// Os registros são escritos uma vez por lote de teclas e o fsync sai no máximo a
+// cada JOURNAL_SYNC_MS. Um journal maior que JOURNAL_COMPACT e que o dobro do texto
+// é reescrito com um registro por trecho que difere do disco. :w recomeça o journal e
+// :q o apaga; qualquer outra saída o deixa para ser reaplicado na próxima abertura.
+//
+// Formato: JOURNAL_MAGIC, tamanho e mtime do arquivo em disco (varints), a base
+// ('D' o arquivo, 'I' a imagem da sessão feita sobre ele) e registros
+//   'E' offset removidos inseridos <bytes>   |   'S' tamanho <texto inteiro>
+
+static struct {
+    int fd;                // -1 = sem journal
+    char path[FILENAME_SIZE + 16];
+    char *buf;             // Registros ainda não escritos
+    size_t len, cap;
+    size_t size;           // Bytes já no arquivo
+    int unsynced;
+    long long last_sync;
+    int discard;           // Saída limpa (:q): o journal pode sumir
+    int on_image;          // Os registros valem sobre a imagem da sessão, não sobre o arquivo
+} Journal = { .fd = -1 };
+
+static void journal_reserve(size_t n) {
+    if (Journal.len + n <= Journal.cap) return;
+    size_t cap = Journal.cap ? Journal.cap * 2 : 4096;
+    while (cap < Journal.len + n) cap *= 2;
+    Journal.buf = realloc(Journal.buf, cap);
+    Journal.cap = cap;
+}
+
+static void journal_varint(unsigned long long x) {
+    journal_reserve(10);
+    do {
+        unsigned char b = x & 0x7F;
+        x >>= 7;
+        Journal.buf[Journal.len++] = (char)(b | (x ? 0x80 : 0));
+    } while (x);
+}
+
+static int journal_get_varint(const unsigned char **p, const unsigned char *end, unsigned long long *out) {
+    unsigned long long x = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        unsigned char b = *(*p)++;
+        x |= (unsigned long long)(b & 0x7F) << shift;
+        if (!(b & 0x80)) { *out = x; return 1; }
+    }
+    return 0;
+}
+
+static void journal_make_path(const char *filename) {
+    side_path(Journal.path, sizeof(Journal.path), filename, ".vswp");
+}
+
+// O journal só vale sobre esta versão do arquivo (e sobre a imagem, se for o caso)
+static void journal_baseline(const char *filename) {
+    unsigned long long size, mtime;
+    file_stamp(filename, &size, &mtime);
+    journal_reserve(sizeof(JOURNAL_MAGIC));
+    memcpy(Journal.buf + Journal.len, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC) - 1);
+    Journal.len += sizeof(JOURNAL_MAGIC) - 1;
+    journal_varint(size);
+    journal_varint(mtime);
+    journal_reserve(1);
+    Journal.buf[Journal.len++] = Journal.on_image ? 'I' : 'D';
+}
+
+static void journal_write(const char *p, size_t len) {
+    size_t off = 0;
+    while (off < len) {
+        ssize_t n = write(Journal.fd, p + off, len - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        off += (size_t)n;
+    }
+    Journal.size += off;
+    Journal.unsynced = 1;
+}
+
+static void journal_flush(void) {
+    if (Journal.fd < 0 || Journal.len == 0) return;
+    journal_write(Journal.buf, Journal.len);
+    Journal.len = 0;
+}
+
+static void journal_sync(void) {
+    journal_flush();
+    if (Journal.fd >= 0 && Journal.unsynced) { fdatasync(Journal.fd); Journal.unsynced = 0; }
+    Journal.last_sync = now_ns() / 1000000;
+}
+
+// Registros 'E' que levam o arquivo em disco ao texto atual, um por trecho do
+// editor_diff: o journal compactado fica do tamanho do que mudou, não do arquivo.
+// Retorna 0 sem escrever nada se o arquivo não pôde ser lido.
+static int journal_diff_records(const char *filename) {
+    size_t len;
+    char *disk = map_file(filename, &len);
+    if (!disk) return 0;
+    editor_diff_t d;
+    editor_diff(&d, (editor_text_t){ NULL, disk, len }, (editor_text_t){ &State.ed, NULL, 0 });
+    unmap_file(disk, len);
+    // Em ordem: cada registro vê o texto com os trechos anteriores já aplicados
+    for (size_t i = 0; i < d.count; i++) {
+        const editor_hunk_t *h = &d.hunks[i];
+        size_t off = d.b[h->b_line].offset, removed = 0, inserted = 0;
+        if (h->a_count) removed = d.a[h->a_line + h->a_count - 1].offset + d.a[h->a_line + h->a_count - 1].len - d.a[h->a_line].offset;
+        if (h->b_count) inserted = d.b[h->b_line + h->b_count - 1].offset + d.b[h->b_line + h->b_count - 1].len - off;
+        journal_reserve(1);
+        Journal.buf[Journal.len++] = 'E';
+        journal_varint(off);
+        journal_varint(removed);
+        journal_varint(inserted);
+        journal_reserve(inserted);
+        Journal.len += editor_copy_range(&State.ed, off, off + inserted, Journal.buf + Journal.len);
+    }
+    editor_diff_free(&d);
+    return 1;
+}
+
+// Reescreve o journal com o que difere do disco (o texto inteiro, se a base é a imagem),
+// ou sem registros logo depois de salvar. Escreve ao lado e renomeia, para nunca ficar sem
+// journal: se algo falhar, o anterior continua aberto e valendo. Retorna 0 nesse caso.
+static int journal_rewrite(const char *filename, int with_text) {
+    char tmp[sizeof(Journal.path) + 4];
+    snprintf(tmp, sizeof(tmp), "%s.new", Journal.path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) { v_message(&State.v, "journal não reescrito (%s): %s", tmp, strerror(errno)); return 0; }
+    journal_flush(); // O que falta do anterior, caso ele tenha de continuar
+    Journal.len = 0;
+    journal_baseline(filename);
+    if (with_text && (Journal.on_image || !journal_diff_records(filename))) {
+        size_t n = editor_get_length(&State.ed);
+        journal_reserve(1);
+        Journal.buf[Journal.len++] = 'S';
+        journal_varint(n);
+        journal_reserve(n);
+        Journal.len += editor_copy_range(&State.ed, 0, n, Journal.buf + Journal.len);
+    }
+    int old_fd = Journal.fd;
+    size_t old_size = Journal.size, want = Journal.len;
+    Journal.fd = fd;
+    Journal.size = 0;
+    journal_flush();
+    if (Journal.size != want || fdatasync(fd) != 0 || rename(tmp, Journal.path) != 0) {
+        int err = errno;
+        close(fd);
+        unlink(tmp);
+        Journal.fd = old_fd;
+        Journal.size = old_size;
+        v_message(&State.v, "journal não reescrito (%s): %s", Journal.path, strerror(err));
+        return 0;
+    }
+    if (old_fd >= 0) close(old_fd);
+    Journal.unsynced = 0;
+    return 1;
+}
+
+// Chamado pelo observer depois de cada edição
+static void journal_record(const editor_change_t *c) {
+    if (Journal.fd < 0) return;
+    journal_reserve(1);
+    Journal.buf[Journal.len++] = 'E';
+    journal_varint(c->offset);
+    journal_varint(c->removed);
+    journal_varint(c->inserted);
+    if (c->inserted < JOURNAL_DIRECT) {
+        journal_reserve(c->inserted);
+        Journal.len += editor_copy_range(&State.ed, c->offset, c->offset + c->inserted, Journal.buf + Journal.len);
+        return;
+    }
+    // Inserção grande (colagem, filtro): vai dos segmentos do buffer direto para o arquivo
+    journal_flush();
+    for (size_t pos = c->offset, end = c->offset + c->inserted, run; pos < end; pos += run) {
+        const char *seg = editor_segment(&State.ed, pos, &run);
+        if (run > end - pos) run = end - pos;
+        journal_write(seg, run);
+    }
+}
+
+// Fim de cada lote de teclas: escreve, compacta se preciso e faz o fsync quando vencer o prazo
+static void journal_tick(void) {
+    if (Journal.fd < 0) return;
+    journal_flush();
+    size_t text = editor_get_length(&State.ed);
+    if (Journal.size > JOURNAL_COMPACT && Journal.size > 2 * text) journal_rewrite(State.filename, 1);
+    if (Journal.unsynced && now_ns() / 1000000 - Journal.last_sync >= JOURNAL_SYNC_MS) journal_sync();
+}
+
+// Reaplica um journal deixado por uma sessão que não terminou. Retorna quantas
+// edições foram recuperadas, -1 se o journal é de outra versão do arquivo ou -2
+// se ele existe mas não pôde ser lido.
+static long journal_recover(const char *filename, size_t *good) {
+    int fd = open(Journal.path, O_RDONLY);
+    if (fd < 0) return errno == ENOENT ? 0 : -2;
+    struct stat st;
+    unsigned char *data = NULL;
+    if (fstat(fd, &st) != 0 || !(data = malloc(st.st_size > 0 ? (size_t)st.st_size : 1))) { close(fd); return -2; }
+    size_t len = 0;
+    while (len < (size_t)st.st_size) {
+        ssize_t n = read(fd, data + len, (size_t)st.st_size - len);
+        if (n <= 0) break;
+        len += (size_t)n;
+    }
+    close(fd);
+
+    Journal.len = 0;
+    journal_baseline(filename);
+    size_t hl = Journal.len;
+    Journal.len = 0;
+    long count = 0;
+    if (len < hl || memcmp(data, Journal.buf, hl) != 0) { free(data); return -1; }
+
+    const unsigned char *p = data + hl, *end = data + len;
+    *good = hl;
+    editor_t *ed = &State.ed;
+    while (p < end) {
+        unsigned long long off, rm, ins;
+        int kind = *p++;
+        if (kind == 'E') {
+            if (!journal_get_varint(&p, end, &off) || !journal_get_varint(&p, end, &rm) ||
+                !journal_get_varint(&p, end, &ins) || (size_t)(end - p) < ins) break;
+            if (off + rm > editor_get_length(ed)) break;
+            editor_delete_range(ed, off, off + rm);
+            editor_move_cursor(ed, off);
+            editor_insert_bytes(ed, (const char *)p, ins);
+        } else if (kind == 'S') {
+            if (!journal_get_varint(&p, end, &ins) || (size_t)(end - p) < ins) break;
+            editor_delete_range(ed, 0, editor_get_length(ed));
+            editor_insert_bytes(ed, (const char *)p, ins);
+        } else break;
+        p += ins;
+        *good = (size_t)(p - data);
+        count++;
+    }
+    editor_move_cursor(ed, 0);
+    free(data);
+    return count;
+}
+
+// Abre (ou recupera) o journal do arquivo recém-carregado. Retorna quantas edições recuperou.
+static long journal_open(const char *filename) {
+    if (!filename[0]) return 0;
+    journal_make_path(filename);
+    size_t good = 0;
+    long n = journal_recover(filename, &good);
+    if (n > 0) {
+        // Continua o mesmo journal, sem a cauda de um registro que ficou pela metade
+        Journal.fd = open(Journal.path, O_WRONLY | O_APPEND | O_CLOEXEC);
+        if (Journal.fd >= 0 && ftruncate(Journal.fd, (off_t)good) == 0) {
+            Journal.size = good;
+            v_message(&State.v, "recuperadas %ld edições de %s", n, Journal.path);
+            return n;
+        }
+    } else if (n < 0) {
+        // O arquivo mudou desde o journal (ou ele não pôde ser lido): guarda o antigo e começa outro
+        char old[sizeof(Journal.path) + 1];
+        snprintf(old, sizeof(old), "%s~", Journal.path);
+        if (rename(Journal.path, old) != 0) {
+            v_message(&State.v, "journal %s não pôde ser lido nem guardado: sem journal", Journal.path);
+            return 0;
+        }
+        v_message(&State.v, "journal %s guardado em %s", n == -1 ? "de outra versão do arquivo" : "ilegível", old);
+    }
+    journal_rewrite(filename, 0);
+    return n > 0 ? n : 0;
+}
+
+// :w — o arquivo em disco é a nova base; com outro nome, o journal muda junto
+static void journal_saved(const char *old_path) {
+    if (!State.filename[0]) return;
+    Journal.on_image = 0;
+    journal_make_path(State.filename);
+    // O antigo só sai depois que o novo existe; se não deu, ele segue sendo o journal
+    if (!journal_rewrite(State.filename, 0)) { snprintf(Journal.path, sizeof(Journal.path), "%s", old_path); return; }
+    if (old_path[0] && strcmp(old_path, Journal.path) != 0) unlink(old_path);
+}
+
+static void journal_close(void) {
+    if (Journal.fd < 0) return;
+    journal_sync();
+    close(Journal.fd);
+    Journal.fd = -1;
+    if (Journal.discard) unlink(Journal.path);
+    free(Journal.buf);
+}
+
+// --- Imagem da sessão ---
+// :mks grava .<arquivo>.vimg com o editor inteiro (texto com o gap, índice de linhas,
+// desfazer) e o estado do v_clone (vista, marcas, registradores). Na abertura a imagem
+// é mapeada em vez de lida, se o arquivo em disco ainda for o mesmo, então abrir 1 GB
+// custa o mesmo que abrir 1 KB. Depois de um :mks (ou de abrir por uma imagem) o :q a
+// atualiza, para a próxima abertura continuar exatamente dali. O journal é recomeçado
+// a cada imagem gravada e passa a valer sobre ela.
+
+static struct {
+    char path[FILENAME_SIZE + 16];
+    int active; // :q grava a imagem
+} Session;
+
+static int session_save(void) {
+    if (!State.filename[0]) return 0;
+    unsigned long long size, mtime;
+    file_stamp(State.filename, &size, &mtime);
+    size_t n = v_session_save(&State.v, NULL);
+    char *extra = malloc(n);
+    v_session_save(&State.v, extra);
+    int ok = editor_save_image(&State.ed, Session.path, size, mtime, extra, n);
+    free(extra);
+    if (!ok) return 0;
+    Session.active = 1;
+    Journal.on_image = 1;
+    journal_rewrite(State.filename, 0);
+    return 1;
+}
+
+// Abre o arquivo pela imagem, se houver uma feita sobre a versão que está em disco.
+// Um buffer aberto com :e (registers 0) traz só a vista e as marcas: os registradores
+// e o '.' da imagem não substituem os da sessão em andamento.
+static int session_open(const char *filename, int registers) {
+    side_path(Session.path, sizeof(Session.path), filename, ".vimg");
+    unsigned long long size, mtime;
+    file_stamp(filename, &size, &mtime);
+    const void *extra;
+    size_t n;
+    if (!editor_load_image(&State.ed, Session.path, size, mtime, &extra, &n)) return 0;
+    if (registers) v_session_load(&State.v, (const char *)extra, n);
+    else {
+        v_state_t tmp;
+        v_buffer_t view = { 0 };
+        v_init(&tmp);
+        v_session_load(&tmp, (const char *)extra, n);
+        v_buffer_swap(&tmp, &view);
+        v_buffer_swap(&State.v, &view);
+        v_buffer_free(&view);
+        v_free(&tmp);
+    }
+    Session.active = 1;
+    Journal.on_image = 1;
+    return 1;
+}
+
+static void session_command(void) {
+    if (session_save()) v_message(&State.v, "sessão gravada em %s", Session.path);
+    else v_message(&State.v, "não foi possível gravar a sessão");
+}
+
+// --- Mudanças externas ---
+// O diretório do arquivo é observado com inotify (o arquivo pode ser trocado por um
+// rename). Se a versão em disco muda e o buffer não foi editado desde a última leitura
+// ou gravação, só a diferença é aplicada (editor_sync_text), num grupo de desfazer:
+// cursor, marcas e histórico sobrevivem. Com edições locais o buffer não é tocado;
+// :e! aplica a versão do disco do mesmo jeito e :w recusa sobrescrever até um :w!.
+
+static struct {
+    int fd;                         // inotify (-1 = sem observação)
+    int wd;
+    unsigned long long size, mtime; // Versão do disco que o buffer conhece
+    size_t changes;                 // Edições desde então
+    int conflict;                   // O disco mudou e o buffer tem edições próprias
+} Watch = { .fd = -1, .wd = -1 };
+
+// A versão em disco agora é a do buffer (depois de ler, gravar ou recarregar)
+static void watch_rebase(void) {
+    file_stamp(State.filename, &Watch.size, &Watch.mtime);
+    Watch.changes = 0;
+    Watch.conflict = 0;
+}
+
+// Observa o diretório de filename (o buffer da tela é o único observado)
+static int watch_dir(const char *filename) {
+    if (!filename[0]) return 0;
+    if (Watch.fd < 0) Watch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (Watch.fd < 0) return 0;
+    if (Watch.wd >= 0) inotify_rm_watch(Watch.fd, Watch.wd);
+    const char *slash = strrchr(filename, '/');
+    char dir[FILENAME_SIZE];
+    if (slash) snprintf(dir, sizeof(dir), "%.*s", (int)(slash - filename) + (slash == filename), filename);
+    else strcpy(dir, ".");
+    Watch.wd = inotify_add_watch(Watch.fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    return 1;
+}
+
+static void watch_open(const char *filename) {
+    if (watch_dir(filename)) watch_rebase();
+}
+
+static int watch_disk_changed(void) {
+    unsigned long long size, mtime;
+    file_stamp(State.filename, &size, &mtime);
+    return size != Watch.size || mtime != Watch.mtime;
+}
+
+// O texto do buffer difere do arquivo em disco (edições recuperadas do journal ou
+// feitas antes do :mks da imagem)
+static int watch_text_differs(void) {
+    size_t len;
+    char *disk = map_file(State.filename, &len);
+    if (!disk) return editor_get_length(&State.ed) > 0;
+    int differs = len != editor_get_length(&State.ed);
+    for (size_t pos = 0, run; !differs && pos < len; pos += run) {
+        const char *seg = editor_segment(&State.ed, pos, &run);
+        if (run > len - pos) run = len - pos;
+        differs = memcmp(seg, disk + pos, run) != 0;
+    }
+    unmap_file(disk, len);
+    return differs;
+}
+
+// Aplica a versão do disco como a diferença em relação ao buffer
+static void watch_reload(void) {
+    size_t len;
+    char *text = map_file(State.filename, &len);
+    if (!text) { v_message(&State.v, "não foi possível ler o arquivo do disco"); return; }
+    editor_save_snapshot(&State.ed);
+    size_t hunks = editor_sync_text(&State.ed, text, len);
+    unmap_file(text, len);
+    char old_path[sizeof(Journal.path)];
+    snprintf(old_path, sizeof(old_path), "%s", Journal.path);
+    journal_saved(old_path);
+    watch_rebase();
+    v_message(&State.v, "recarregado do disco: %zu trecho%s alterado%s", hunks, hunks == 1 ? "" : "s",
+              hunks == 1 ? "" : "s");
+}
+
+// A versão do disco mudou: recarrega, ou marca o conflito se o buffer tem edições
+static void watch_changed(void) {
+    if (Watch.changes == 0) watch_reload();
+    else {
+        Watch.conflict = 1;
+        v_message(&State.v, "o arquivo mudou no disco: :e! recarrega, :w! sobrescreve");
+    }
+}
+
+// Eventos do inotify: só interessa o nosso arquivo, e só se ele mudou de verdade
+// (o :w também gera um evento, mas deixa a versão igual à conhecida)
+static int watch_event(void) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const char *slash = strrchr(State.filename, '/');
+    const char *base = slash ? slash + 1 : State.filename;
+    int ours = 0;
+    ssize_t n;
+    while ((n = read(Watch.fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            struct inotify_event *e = (struct inotify_event *)p;
+            if (e->len && strcmp(e->name, base) == 0) ours = 1;
+        }
+    }
+    if (!ours || !watch_disk_changed()) return 0;
+    watch_changed();
+    return 1;
+}
+
+static void save_file(State_t *s, const char *name, int force) {
+    char old_path[sizeof(Journal.path)];
+    snprintf(old_path, sizeof(old_path), "%s", Journal.path);
+    if (!force && !name && s->filename[0] && (Watch.conflict || (Watch.changes && watch_disk_changed()))) {
+        Watch.conflict = 1;
+        v_message(&s->v, "o arquivo mudou no disco desde a leitura: :w! sobrescreve");
+        return;
+    }
+    if (name) { strncpy(s->filename, name, FILENAME_SIZE - 1); }
+    if (!s->filename[0] || !editor_save_file(&s->ed, s->filename)) return;
+    journal_saved(old_path);
+    if (name) watch_open(s->filename);
+    else watch_rebase();
+    // Com outro nome a imagem antiga não serve mais; a do novo nome sai no :q
+    char path[sizeof(Session.path)];
+    side_path(path, sizeof(path), s->filename, ".vimg");
+    if (strcmp(path, Session.path) != 0) { if (Session.active) unlink(Session.path); strcpy(Session.path, path); }
+}
+
 // --- Cores Pastéis ---
 #define CLR_PASTEL_PINK   255, 179, 186
 #define CLR_PASTEL_GREEN  186, 255, 201
@@ -37,6 +763,19 @@ struct termios orig_termios;
 #define CLR_PASTEL_PURPLE 221, 160, 221
 #define CLR_SOFT_WHITE    240, 240, 240
 #define CLR_SELECTION_BG  60, 60, 60 // Cinza escuro para destaque
+#define CLR_MATCH_BG      90, 80, 40 // Fundo das ocorrências da busca
+#define CLR_SOFT_GRAY     140, 140, 150
+#define CLR_PASTEL_RED    255, 140, 140
+
+// Cor de cada classe de token do syntax.h
+static const unsigned char syntax_colors[SYN_COUNT][3] = {
+    [SYN_NORMAL] = {CLR_SOFT_WHITE},   [SYN_KEYWORD] = {CLR_PASTEL_PINK},
+    [SYN_TYPE] = {CLR_PASTEL_BLUE},    [SYN_STRING] = {CLR_PASTEL_GREEN},
+    [SYN_NUMBER] = {CLR_PASTEL_YELLOW}, [SYN_COMMENT] = {CLR_SOFT_GRAY},
+    [SYN_PREPROC] = {CLR_PASTEL_PURPLE}, [SYN_KEY] = {CLR_PASTEL_BLUE},
+    [SYN_VARIABLE] = {CLR_PASTEL_YELLOW}, [SYN_ERROR] = {CLR_PASTEL_RED},
+    [SYN_WARN] = {CLR_PASTEL_YELLOW},  [SYN_INFO] = {CLR_PASTEL_GREEN},
+};
 
 // --- Macros de Cor Robustas ---
 // V_CLR_TEXT agora reseta o fundo para evitar vazamentos
@@ -45,11 +784,16 @@ struct termios orig_termios;
 #define V_CLR_LINENUM()   term_fg_rgb(CLR_PASTEL_PURPLE)
 #define V_CLR_STATUS()    do { term_fg_rgb(40, 40, 40); term_bg_rgb(CLR_PASTEL_BLUE); } while(0)
 #define V_CLR_SELECTION() term_bg_rgb(CLR_SELECTION_BG)
+#define V_CLR_MATCH()     term_bg_rgb(CLR_MATCH_BG)
+#define V_CLR_SYNTAX(k)   term_fg_rgb(syntax_colors[k][0], syntax_colors[k][1], syntax_colors[k][2])
+#define V_CLR_DIFF(k)     do { if ((k) == '+') term_fg_rgb(CLR_PASTEL_GREEN); \
+                               else if ((k) == '-') term_fg_rgb(CLR_PASTEL_RED); else term_fg_rgb(CLR_PASTEL_YELLOW); } while(0)
 
 // --- Primitivas de Terminal ---
 #define V_TERM_GOTOXY(x, y)      term_gotoxy(x, y)
 #define V_TERM_CLEAR()           term_clear()
 #define V_TERM_CURSOR_SHOW(s)    term_cursor_show(s)
+#define V_TERM_FLUSH()           // O laço principal esvazia stdout depois do v_render
 
 // --- Primitivas de Editor ---
 #define V_ED_GET_CURSOR(v)          editor_get_cursor(&((State_t*)(v)->udata)->ed)
@@ -58,46 +802,53 @@ struct termios orig_termios;
 #define V_ED_GET_LENGTH(v)          editor_get_length(&((State_t*)(v)->udata)->ed)
 #define V_ED_DELETE_RANGE(v, s, e)  editor_delete_range(&((State_t*)(v)->udata)->ed, s, e)
 #define V_ED_INSERT_TEXT(v, txt)    editor_insert_text(&((State_t*)(v)->udata)->ed, txt)
+#define V_ED_INSERT_BYTES(v, t, n)  editor_insert_bytes(&((State_t*)(v)->udata)->ed, t, n)
 #define V_ED_SAVE_SNAPSHOT(v)       editor_save_snapshot(&((State_t*)(v)->udata)->ed)
 #define V_ED_UNDO(v)                editor_undo(&((State_t*)(v)->udata)->ed)
 #define V_ED_FIND_LINE_START(v, p)  editor_find_line_start(&((State_t*)(v)->udata)->ed, p)
 #define V_ED_FIND_LINE_END(v, p)    editor_find_line_end(&((State_t*)(v)->udata)->ed, p)
 #define V_ED_GET_ROW_COL(v, p, r, c) editor_get_row_col(&((State_t*)(v)->udata)->ed, p, r, c)
+#define V_ED_COPY_RANGE(v, s, e, d) editor_copy_range(&((State_t*)(v)->udata)->ed, s, e, d)
+#define V_SYN_LEX(v, st, t, n, out) lex_line(((State_t*)(v)->udata)->lang, st, t, n, out)
+#define V_ED_LINE_COUNT(v)          editor_line_count(&((State_t*)(v)->udata)->ed)
+#define V_ED_LINE_OFFSET(v, l)      editor_line_offset(&((State_t*)(v)->udata)->ed, l)
+#define V_ED_LINE_OF(v, p)          editor_line_of(&((State_t*)(v)->udata)->ed, p)
 
-#define V_ED_YANK(v, s, e) do { \
-    State_t *s_ptr = (State_t*)(v)->udata; \
-    if (s_ptr->clipboard) free(s_ptr->clipboard); \
-    s_ptr->clipboard = editor_get_range(&s_ptr->ed, s, e); \
-} while(0)
-
-#define V_ED_PASTE(v) do { \
-    State_t *s_ptr = (State_t*)(v)->udata; \
-    if (s_ptr->clipboard) { editor_save_snapshot(&s_ptr->ed); editor_insert_text(&s_ptr->ed, s_ptr->clipboard); } \
-} while(0)
-
-#define V_ED_SEARCH(v, q, fwd) do { \
-    State_t *s_ptr = (State_t*)(v)->udata; \
-    int pos = editor_find(&s_ptr->ed, q, editor_get_cursor(&s_ptr->ed) + 1); \
-    if (pos == -1) pos = editor_find(&s_ptr->ed, q, 0); \
-    if (pos != -1) editor_move_cursor(&s_ptr->ed, pos); \
-} while(0)
+#define V_ED_FIND(v, q, n, s, e)    editor_find_range(&((State_t*)(v)->udata)->ed, q, n, s, e)
 
-#define V_ACTION_MOVE_LINE(v, dir) do { \
-    State_t *s_ptr = (State_t*)(v)->udata; \
-    if (dir > 0) editor_move_down(&s_ptr->ed); else editor_move_up(&s_ptr->ed); \
-} while(0)
+static void diff_command(const char *arg);
+static void diff_off(void);
+static int filter_command(const char *cmd);
+static int bulk_command(const char *cmd);
+static int buffer_command(const char *cmd);
+static void buffers_quit(void);
 
 #define V_ACTION_COMMAND(v, cmd) do { \
     State_t *s_ptr = (State_t*)(v)->udata; \
-    if (strcmp(cmd, "q") == 0) (v)->running = 0; \
-    else if (strcmp(cmd, "w") == 0) { if (s_ptr->filename[0]) editor_save_file(&s_ptr->ed, s_ptr->filename); } \
-    else if (strncmp(cmd, "w ", 2) == 0) { strncpy(s_ptr->filename, cmd + 2, FILENAME_SIZE - 1); editor_save_file(&s_ptr->ed, s_ptr->filename); } \
+    if (STATS_COMMAND(v, cmd)) {} \
+    else if (strcmp(cmd, "q") == 0) { buffers_quit(); (v)->running = 0; } \
+    else if (strcmp(cmd, "mks") == 0) session_command(); \
+    else if (strcmp(cmd, "w") == 0) save_file(s_ptr, NULL, 0); \
+    else if (strcmp(cmd, "w!") == 0) save_file(s_ptr, NULL, 1); \
+    else if (strncmp(cmd, "w ", 2) == 0) save_file(s_ptr, cmd + 2, 0); \
+    else if (strcmp(cmd, "e!") == 0) { if (s_ptr->filename[0]) watch_reload(); } \
+    else if (strcmp(cmd, "diff") == 0 || strncmp(cmd, "diff ", 5) == 0) diff_command(cmd + 4); \
+    else if (strcmp(cmd, "diffoff") == 0) diff_off(); \
+    else if (buffer_command(cmd)) {} \
+    else if (filter_command(cmd)) {} \
+    else if (bulk_command(cmd)) {} \
 } while(0)
 
+static int lex_line(const syntax_lang_t *lang, int state, const char *text, size_t len, unsigned char *out) {
+    if (lang) return syntax_lex_line(lang, state, text, len, out);
+    if (out) memset(out, SYN_NORMAL, len);
+    return 0;
+}
+
 #define V_CLONE_IMPLEMENTATION
 #include "v_clone.h"
 
-void disable_raw_mode() { tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios); term_cursor_show(1); term_clear(); }
+void disable_raw_mode() { term_bracketed_paste(0); tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios); term_cursor_show(1); term_clear(); }
 void enable_raw_mode() {
     tcgetattr(STDIN_FILENO, &orig_termios); atexit(disable_raw_mode);
     struct termios raw = orig_termios;
@@ -105,29 +856,856 @@ void enable_raw_mode() {
     raw.c_oflag &= ~(OPOST);
     raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
     tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+    term_bracketed_paste(1);
+}
+
+// --- Entrada ---
+// Bytes lidos do terminal ficam aqui até virarem teclas (ou uma colagem inteira)
+static char in_buf[INPUT_BUF_SIZE];
+static size_t in_head, in_len;
+static FILE *keylog; // V_KEYLOG=arquivo grava a entrada crua, para o v_replay
+static int needs_render = 1;
+
+// Lê mais bytes para o buffer de entrada. Retorna 0 se nada chegou dentro do timeout.
+// Eventos do arquivo (inotify) são tratados aqui também, para acordar o mesmo poll.
+static int input_fill(int timeout_ms) {
+    if (in_head > 0) { memmove(in_buf, in_buf + in_head, in_len); in_head = 0; }
+    if (in_len == INPUT_BUF_SIZE) return 0;
+    struct pollfd p[2] = { { STDIN_FILENO, POLLIN, 0 }, { Watch.fd, POLLIN, 0 } };
+    if (timeout_ms >= 0) {
+        if (poll(p, Watch.fd >= 0 ? 2 : 1, timeout_ms) <= 0) return 0;
+        if ((p[1].revents & POLLIN) && watch_event()) needs_render = 1;
+        if (!(p[0].revents & (POLLIN | POLLHUP | POLLERR))) return 0;
+    }
+    ssize_t n;
+    STATS_TIME(ST_READ, n = read(STDIN_FILENO, in_buf + in_len, INPUT_BUF_SIZE - in_len));
+    if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN)) State.v.running = 0;
+    if (n <= 0) return 0;
+    if (keylog) fwrite(in_buf + in_len, 1, (size_t)n, keylog);
+    in_len += (size_t)n;
+    return 1;
+}
+
+// Normaliza quebras de linha vindas do terminal (\r e \r\n viram \n)
+static size_t paste_normalize(char *s, size_t len) {
+    size_t w = 0;
+    for (size_t r = 0; r < len; r++) {
+        if (s[r] == '\r') { s[w++] = '\n'; if (r + 1 < len && s[r + 1] == '\n') r++; }
+        else s[w++] = s[r];
+    }
+    return w;
+}
+
+// Próximo pedaço da colagem; 0 se a entrada acabou ou ficou PASTE_TIMEOUT ms parada.
+// Sem ISIG não há Ctrl+C: um marcador final perdido não pode travar o editor.
+static size_t paste_read(char *dst, size_t size) {
+    struct pollfd p = { STDIN_FILENO, POLLIN, 0 };
+    for (;;) {
+        int r = poll(&p, 1, PASTE_TIMEOUT);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return 0;
+        ssize_t n = read(STDIN_FILENO, dst, size);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        if (n <= 0) return 0;
+        if (keylog) fwrite(dst, 1, (size_t)n, keylog);
+        return (size_t)n;
+    }
+}
+
+// Sem memória para guardar a colagem: o resto dela, a partir do que está em in_buf,
+// é lido e descartado até o marcador final, para não virar comandos
+static void paste_discard(void) {
+    v_message(&State.v, "sem memória para a colagem: descartada");
+    if (in_head > 0) { memmove(in_buf, in_buf + in_head, in_len); in_head = 0; }
+    for (;;) {
+        char *end = memmem(in_buf, in_len, PASTE_END, PASTE_MARK_LEN);
+        if (end) {
+            in_len -= (size_t)(end + PASTE_MARK_LEN - in_buf);
+            memmove(in_buf, end + PASTE_MARK_LEN, in_len);
+            return;
+        }
+        size_t keep = in_len < PASTE_MARK_LEN - 1 ? in_len : PASTE_MARK_LEN - 1;
+        memmove(in_buf, in_buf + in_len - keep, keep);
+        size_t n = paste_read(in_buf + keep, INPUT_BUF_SIZE - keep);
+        in_len = n ? keep + n : 0;
+        if (!n) return;
+    }
+}
+
+// Acumula o conteúdo colado até ESC[201~ e entrega tudo de uma vez ao v_clone
+static void read_paste(void) {
+    size_t cap = INPUT_BUF_SIZE * 2, len = in_len;
+    char *buf = malloc(cap);
+    if (!buf) { paste_discard(); return; }
+    memcpy(buf, in_buf + in_head, in_len);
+    in_head = in_len = 0;
+
+    char *end = NULL;
+    size_t scanned = 0;
+    while (!(end = memmem(buf + scanned, len - scanned, PASTE_END, PASTE_MARK_LEN))) {
+        if (len >= PASTE_MARK_LEN) scanned = len - (PASTE_MARK_LEN - 1);
+        if (cap - len < INPUT_BUF_SIZE) {
+            char *grown = realloc(buf, cap * 2);
+            if (!grown) {
+                in_len = len - scanned;
+                memcpy(in_buf, buf + scanned, in_len);
+                free(buf);
+                paste_discard();
+                return;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+        size_t n = paste_read(buf + len, INPUT_BUF_SIZE);
+        if (!n) break;
+        len += n;
+    }
+
+    size_t body = end ? (size_t)(end - buf) : len;
+    if (end) {
+        // O que veio depois do marcador final são teclas normais
+        size_t rest = len - body - PASTE_MARK_LEN;
+        memcpy(in_buf, end + PASTE_MARK_LEN, rest);
+        in_len = rest;
+    }
+    STATS_TIME(ST_KEY, v_paste(&State.v, buf, paste_normalize(buf, body)));
+    free(buf);
+}
+
+// Retorna a próxima tecla, ou -1 se a entrada foi consumida por uma colagem.
+// Só deve ser chamada com bytes pendentes no buffer.
+static int input_next_key(void) {
+    if (in_buf[in_head] == V_KEY_ESC) {
+        size_t m = 1;
+        while (m < PASTE_MARK_LEN) {
+            if (m >= in_len && !input_fill(ESC_TIMEOUT)) break;
+            if (in_buf[in_head + m] != PASTE_BEGIN[m]) break;
+            m++;
+        }
+        if (m == PASTE_MARK_LEN) {
+            in_head += PASTE_MARK_LEN; in_len -= PASTE_MARK_LEN;
+            read_paste();
+            return -1;
+        }
+    }
+    int key = (unsigned char)in_buf[in_head++];
+    in_len--;
+    return key;
+}
+
+// --- Jobs de fundo ---
+// Cada job faz uma fatia curta de trabalho e retorna 1 enquanto ainda tiver o que fazer
+typedef int (*idle_job_fn)(void *udata);
+
+static struct { idle_job_fn fn; void *udata; int pending; } idle_jobs[MAX_IDLE_JOBS];
+static int idle_job_count;
+
+static long long now_us(void) {
+    return now_ns() / 1000;
+}
+
+// Registra (ou reativa) um job de fundo
+void idle_schedule(idle_job_fn fn, void *udata) {
+    for (int i = 0; i < idle_job_count; i++) {
+        if (idle_jobs[i].fn == fn && idle_jobs[i].udata == udata) { idle_jobs[i].pending = 1; return; }
+    }
+    if (idle_job_count == MAX_IDLE_JOBS) return;
+    idle_jobs[idle_job_count].fn = fn; idle_jobs[idle_job_count].udata = udata;
+    idle_jobs[idle_job_count++].pending = 1;
+}
+
+static int idle_has_work(void) {
+    for (int i = 0; i < idle_job_count; i++) if (idle_jobs[i].pending) return 1;
+    return 0;
+}
+
+// Roda os jobs em round-robin até esgotar a fatia de tempo ou o trabalho
+static void idle_run(long long budget_us) {
+    long long deadline = now_us() + budget_us;
+    int busy = 1;
+    while (busy && now_us() < deadline) {
+        busy = 0;
+        for (int i = 0; i < idle_job_count; i++) {
+            if (!idle_jobs[i].pending) continue;
+            idle_jobs[i].pending = idle_jobs[i].fn(idle_jobs[i].udata);
+            busy |= idle_jobs[i].pending;
+        }
+    }
+}
+
+// --- :diff ---
+// Compara o buffer com o arquivo em disco (:diff) ou com o texto de N desfazer atrás
+// (:diff N). Só o hash das linhas é feito na hora; o diff roda em fatias de DIFF_SLICE
+// comparações no tempo ocioso e as marcas aparecem na coluna de números quando ele acaba.
+// O outro lado (o arquivo mapeado ou o editor reconstruído) fica vivo até lá, porque o
+// diff confere os bytes das linhas de mesmo hash. Uma edição no meio do caminho
+// descarta o resultado.
+
+static struct {
+    editor_diff_t d;
+    editor_t old;     // :diff N: o texto de N desfazer atrás
+    char *disk;       // :diff: o arquivo mapeado (NULL se o outro lado é old)
+    size_t disk_len;
+    int running;
+    int stale;        // O texto mudou depois do editor_diff_begin
+    char what[32];    // Com o que se comparou, para a mensagem
+} Diff;
+
+// Solta o diff em andamento e o texto com que ele compara
+static void diff_cancel(void) {
+    if (!Diff.running) return;
+    editor_diff_free(&Diff.d);
+    if (Diff.disk) unmap_file(Diff.disk, Diff.disk_len); else editor_free(&Diff.old);
+    Diff.disk = NULL;
+    Diff.running = 0;
+}
+
+static void diff_finish(void) {
+    if (Diff.stale) { diff_cancel(); v_message(&State.v, "o texto mudou durante o :diff"); return; }
+    size_t lines = editor_line_count(&State.ed), added = 0, removed = 0;
+    v_diff_mark_t *marks = malloc(sizeof(v_diff_mark_t) * (Diff.d.count ? Diff.d.count : 1));
+    for (size_t i = 0; i < Diff.d.count; i++) {
+        const editor_hunk_t *h = &Diff.d.hunks[i];
+        added += h->b_count; removed += h->a_count;
+        if (h->b_count) marks[i] = (v_diff_mark_t){ h->b_line, h->b_count, h->a_count ? '~' : '+' };
+        else marks[i] = (v_diff_mark_t){ h->b_line < lines ? h->b_line : lines - 1, 1, '-' };
+    }
+    v_diff_set(&State.v, marks, Diff.d.count);
+    if (Diff.d.count == 0) v_message(&State.v, "sem diferenças com %s", Diff.what);
+    else v_message(&State.v, "%zu trecho%s diferente%s de %s (+%zu -%zu linhas)", Diff.d.count,
+                   Diff.d.count == 1 ? "" : "s", Diff.d.count == 1 ? "" : "s", Diff.what, added, removed);
+    free(marks);
+    diff_cancel();
+}
+
+static int diff_job(void *udata) {
+    (void)udata;
+    if (Diff.running && !Diff.stale && editor_diff_step(&Diff.d, DIFF_SLICE)) return 1;
+    if (Diff.running) diff_finish();
+    needs_render = 1;
+    return 0;
+}
+
+static void diff_command(const char *arg) {
+    editor_text_t a = { NULL, NULL, 0 };
+    while (*arg == ' ') arg++;
+    int n = atoi(arg);
+    if (*arg && n <= 0) { v_message(&State.v, "uso: :diff [N]"); return; }
+    diff_cancel();
+    if (*arg) {
+        n = editor_undo_state(&State.ed, n, &Diff.old);
+        snprintf(Diff.what, sizeof(Diff.what), "%d desfazer atrás", n);
+        a.ed = &Diff.old;
+    } else {
+        if (!State.filename[0] || !(Diff.disk = map_file(State.filename, &Diff.disk_len))) { v_message(&State.v, "sem arquivo em disco"); return; }
+        snprintf(Diff.what, sizeof(Diff.what), "o disco");
+        a.text = Diff.disk; a.len = Diff.disk_len;
+    }
+    editor_diff_begin(&Diff.d, a, (editor_text_t){ &State.ed, NULL, 0 });
+    Diff.running = 1; Diff.stale = 0;
+    idle_schedule(diff_job, NULL);
+}
+
+static void diff_off(void) {
+    diff_cancel();
+    v_diff_set(&State.v, NULL, 0);
+}
+
+// --- Filtros (:%!cmd, :'<,'>!cmd, :r !cmd) ---
+// O trecho vai para o stdin do comando direto dos segmentos do gap buffer (vmsplice)
+// e a saída, junto com o stderr, vai para um arquivo anônimo (splice), bombeando os
+// dois lados no mesmo poll para que uma saída grande não trave o comando. O buffer
+// só muda no fim, num único grupo de desfazer: apaga o trecho e insere a saída de
+// uma vez. Se o comando falha, o texto fica como estava.
+
+// Última linha de verdade: o "" depois do '\n' final não conta
+static size_t cmd_last_line(void) {
+    size_t n = editor_line_count(&State.ed), len = editor_get_length(&State.ed);
+    return n > 1 && editor_get_char(&State.ed, len - 1) == '\n' ? n - 2 : n - 1;
+}
+
+// Linha (0-indexada) de um endereço N . $ 'x no início de p. Retorna o resto, ou NULL.
+static const char *cmd_addr(const char *p, size_t *line) {
+    size_t n = cmd_last_line() + 1;
+    if (isdigit((unsigned char)*p)) {
+        char *end;
+        unsigned long l = strtoul(p, &end, 10);
+        *line = l ? l - 1 : 0; p = end;
+    } else if (*p == '.') { *line = editor_line_of(&State.ed, editor_get_cursor(&State.ed)); p++; }
+    else if (*p == '$') { *line = n - 1; p++; }
+    else if (*p == '\'') {
+        int i = v_mark_index(p[1]);
+        if (i < 0 || !(State.v.marks_set & (1u << i))) return NULL;
+        *line = editor_line_of(&State.ed, State.v.marks[i]); p += 2;
+    } else return NULL;
+    if (*line >= n) *line = n - 1;
+    return p;
+}
+
+// Intervalo de linhas de um comando ':' (%, a,b ou a). Sem endereço, a linha do cursor.
+static const char *cmd_range(const char *p, size_t *first, size_t *last) {
+    if (*p == '%') { *first = 0; *last = cmd_last_line(); return p + 1; }
+    const char *q = cmd_addr(p, first);
+    if (!q) { *first = *last = editor_line_of(&State.ed, editor_get_cursor(&State.ed)); return *p == '\'' ? NULL : p; }
+    *last = *first;
+    if (*q == ',' && !(q = cmd_addr(q + 1, last))) return NULL;
+    if (*first > *last) { size_t t = *first; *first = *last; *last = t; }
+    return q;
+}
+
+// Roda cmd com [start, end) do buffer na entrada. Retorna o fd com a saída
+// (o chamador fecha), ou -1; *status recebe o status do waitpid.
+static int filter_run(const char *cmd, size_t start, size_t end, int *status) {
+    int in[2], out[2], mem = memfd_create("v_clone-filtro", MFD_CLOEXEC);
+    if (mem < 0) return -1;
+    if (pipe2(in, O_CLOEXEC) != 0) { close(mem); return -1; }
+    if (pipe2(out, O_CLOEXEC) != 0) { close(in[0]); close(in[1]); close(mem); return -1; }
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(in[0], STDIN_FILENO); dup2(out[1], STDOUT_FILENO); dup2(out[1], STDERR_FILENO);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+    close(in[0]); close(out[1]);
+    int wfd = in[1], rfd = out[0];
+    if (pid < 0) { close(wfd); close(rfd); close(mem); return -1; }
+    fcntl(wfd, F_SETFL, O_NONBLOCK); fcntl(rfd, F_SETFL, O_NONBLOCK);
+    void (*old_pipe)(int) = signal(SIGPIPE, SIG_IGN); // Comando que não lê tudo: EPIPE, não morte
+    int zero_in = 1, zero_out = 1; // Caem para write/read onde vmsplice/splice não servem
+    size_t pos = start;
+    if (pos == end) { close(wfd); wfd = -1; }
+    while (rfd >= 0) {
+        struct pollfd p[2] = { { wfd, POLLOUT, 0 }, { rfd, POLLIN, 0 } };
+        if (poll(p, 2, -1) < 0) { if (errno == EINTR) continue; break; }
+        if (wfd >= 0 && p[0].revents) {
+            size_t run;
+            const char *seg = editor_segment(&State.ed, pos, &run);
+            if (run > end - pos) run = end - pos;
+            if (run > FILTER_CHUNK) run = FILTER_CHUNK;
+            ssize_t n = -1;
+            if (zero_in) {
+                struct iovec iov = { (void *)seg, run };
+                if ((n = vmsplice(wfd, &iov, 1, SPLICE_F_NONBLOCK)) < 0 && errno != EAGAIN) zero_in = 0;
+            }
+            if (!zero_in) n = write(wfd, seg, run);
+            if (n > 0) pos += (size_t)n;
+            if (pos == end || (n < 0 && errno != EAGAIN && errno != EINTR)) { close(wfd); wfd = -1; }
+        }
+        if (p[1].revents) {
+            ssize_t n = -1;
+            if (zero_out && (n = splice(rfd, NULL, mem, NULL, FILTER_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) < 0 &&
+                errno != EAGAIN) zero_out = 0;
+            if (!zero_out) {
+                char buf[65536];
+                if ((n = read(rfd, buf, sizeof(buf))) > 0 && write(mem, buf, (size_t)n) != n) n = -1;
+            }
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) { close(rfd); rfd = -1; }
+        }
+    }
+    if (wfd >= 0) close(wfd);
+    if (rfd >= 0) close(rfd);
+    signal(SIGPIPE, old_pipe);
+    while (waitpid(pid, status, 0) < 0 && errno == EINTR) {}
+    return mem;
+}
+
+// Troca [start, end) pela saída de cmd. Retorna quantos bytes entraram, ou -1.
+static long filter_apply(const char *cmd, size_t start, size_t end, size_t at, const char *prefix) {
+    int status;
+    int fd = filter_run(cmd, start, end, &status);
+    if (fd < 0) { v_message(&State.v, "não foi possível rodar o comando"); return -1; }
+    struct stat st;
+    size_t len = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+    char *text = len ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    close(fd);
+    if (text == MAP_FAILED) { v_message(&State.v, "não foi possível ler a saída do comando"); return -1; }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        size_t l = 0;
+        while (l < len && l < 100 && text[l] != '\n') l++;
+        v_message(&State.v, "o comando falhou (%d)%s%.*s", WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+                  l ? ": " : "", (int)l, text);
+        unmap_file(text, len);
+        return -1;
+    }
+    editor_save_snapshot(&State.ed);
+    if (end > start) editor_delete_range(&State.ed, start, end);
+    editor_move_cursor(&State.ed, at);
+    if (prefix) editor_insert_text(&State.ed, prefix);
+    editor_insert_bytes(&State.ed, text, len);
+    unmap_file(text, len);
+    return (long)len;
+}
+
+static int filter_command(const char *cmd) {
+    size_t first, last, line = editor_line_of(&State.ed, editor_get_cursor(&State.ed));
+    if (strncmp(cmd, "r !", 3) == 0 || strncmp(cmd, "r!", 2) == 0) {
+        // Abaixo da linha do cursor; sem '\n' no fim do arquivo, a saída começa numa linha nova
+        size_t at = editor_line_offset(&State.ed, line + 1), len = editor_get_length(&State.ed);
+        int newline = line + 1 >= editor_line_count(&State.ed) && len > 0 && editor_get_char(&State.ed, len - 1) != '\n';
+        if (filter_apply(strchr(cmd, '!') + 1, at, at, newline ? len : at, newline ? "\n" : NULL) < 0) return 1;
+        size_t end = editor_line_of(&State.ed, editor_get_cursor(&State.ed));
+        editor_move_cursor(&State.ed, editor_line_offset(&State.ed, line + 1));
+        v_message(&State.v, "%zu linhas lidas", end - line - 1);
+        return 1;
+    }
+    const char *p = cmd_range(cmd, &first, &last);
+    if (!p || p == cmd || *p != '!') return 0;
+    size_t start = editor_line_offset(&State.ed, first), end = editor_line_offset(&State.ed, last + 1);
+    if (filter_apply(p + 1, start, end, start, NULL) < 0) return 1;
+    size_t lines = editor_line_of(&State.ed, editor_get_cursor(&State.ed)) - first;
+    editor_move_cursor(&State.ed, start);
+    v_message(&State.v, "%zu linhas filtradas em %zu", last - first + 1, lines);
+    return 1;
+}
+
+// --- Operações em bloco (:sort, :g/padrão/d, :v/padrão/d, :j) ---
+// Trabalham sobre descritores (offset, tamanho) das linhas, tirados do índice de linhas,
+// com o gap fora do intervalo para que ele fique contíguo. O resultado é montado numa
+// passada só e entra no lugar do intervalo num único grupo de desfazer.
+
+typedef struct {
+    size_t off, len;             // Relativos ao início do intervalo; len sem o '\n'
+    size_t key;                  // Início da chave dentro da linha (:sort k)
+    union {
+        unsigned long long head; // Primeiros 8 bytes da chave, para comparar sem ir ao texto
+        double num;              // Número da chave (:sort n); -inf se a linha não tem número
+    };
+} sort_line_t;
+
+static struct {
+    const char *base;
+    int numeric, reverse;
+} Sort;
+
+typedef struct {
+    sort_line_t *lines, *tmp;
+    size_t n;
+    int threads;
+} sort_job_t;
+
+static int sort_cmp(const sort_line_t *a, const sort_line_t *b) {
+    int r;
+    if (Sort.numeric) r = (a->num > b->num) - (a->num < b->num);
+    else if (a->head != b->head) r = a->head < b->head ? -1 : 1;
+    else {
+        size_t la = a->len - a->key, lb = b->len - b->key;
+        r = memcmp(Sort.base + a->off + a->key, Sort.base + b->off + b->key, la < lb ? la : lb);
+        if (r == 0) r = (la > lb) - (la < lb);
+    }
+    return Sort.reverse ? -r : r;
+}
+
+// Merge sort estável; enquanto houver threads sobrando, a metade esquerda vai para outra
+static void *sort_run(void *arg) {
+    sort_job_t *j = (sort_job_t *)arg;
+    sort_line_t *l = j->lines;
+    size_t n = j->n, h = n / 2;
+    if (n <= 16) {
+        for (size_t i = 1; i < n; i++) {
+            sort_line_t x = l[i];
+            size_t k = i;
+            for (; k > 0 && sort_cmp(&x, &l[k - 1]) < 0; k--) l[k] = l[k - 1];
+            l[k] = x;
+        }
+        return NULL;
+    }
+    sort_job_t left = { l, j->tmp, h, j->threads / 2 }, right = { l + h, j->tmp + h, n - h, j->threads - j->threads / 2 };
+    pthread_t t;
+    int spawned = j->threads > 1 && n >= SORT_PARALLEL && pthread_create(&t, NULL, sort_run, &left) == 0;
+    if (!spawned) sort_run(&left);
+    sort_run(&right);
+    if (spawned) pthread_join(t, NULL);
+    if (sort_cmp(&l[h - 1], &l[h]) <= 0) return NULL;
+    // Só a metade esquerda sai do lugar: a saída nunca alcança a direita ainda não lida
+    memcpy(j->tmp, l, h * sizeof(sort_line_t));
+    size_t a = 0, b = h, o = 0;
+    while (a < h && b < n) l[o++] = sort_cmp(&l[b], &j->tmp[a]) < 0 ? l[b++] : j->tmp[a++];
+    memcpy(l + o, j->tmp + a, (h - a) * sizeof(sort_line_t));
+    return NULL;
+}
+
+// Deixa as linhas [first, last] contíguas. Retorna o início delas; *start e *end recebem o intervalo.
+static const char *bulk_begin(size_t first, size_t last, size_t *start, size_t *end) {
+    *start = editor_line_offset(&State.ed, first);
+    *end = editor_line_offset(&State.ed, last + 1);
+    editor_move_cursor(&State.ed, *start);
+    size_t run;
+    return editor_segment(&State.ed, *start, &run);
+}
+
+// Tamanho da linha l sem o '\n', com o intervalo começando em start
+static size_t bulk_line(const char *base, size_t start, size_t l, size_t *off) {
+    size_t s = editor_line_offset(&State.ed, l), e = editor_line_offset(&State.ed, l + 1);
+    *off = s - start;
+    return e - s - (e > s && base[e - 1 - start] == '\n');
+}
+
+// Troca [start, end) por text[0, len) num único grupo de desfazer
+static void bulk_replace(size_t start, size_t end, const char *text, size_t len) {
+    editor_save_snapshot(&State.ed);
+    editor_delete_range(&State.ed, start, end);
+    editor_move_cursor(&State.ed, start);
+    editor_insert_bytes(&State.ed, text, len);
+    editor_move_cursor(&State.ed, start);
+}
+
+// Monta as linhas na ordem dada; a última só leva '\n' se o intervalo terminava com um
+static char *bulk_join(const char *base, const sort_line_t *lines, size_t n, int newline, size_t *len) {
+    size_t total = 0, o = 0;
+    for (size_t i = 0; i < n; i++) total += lines[i].len + 1;
+    char *out = malloc(total ? total : 1);
+    for (size_t i = 0; i < n; i++) {
+        memcpy(out + o, base + lines[i].off, lines[i].len);
+        o += lines[i].len;
+        if (i + 1 < n || newline) out[o++] = '\n';
+    }
+    *len = o;
+    return out;
+}
+
+// :sort [n] [r] [u] [k N] (ou :sort! para a ordem inversa)
+static void sort_command(const char *opts, size_t first, size_t last) {
+    int unique = 0;
+    size_t field = 0;
+    Sort.numeric = Sort.reverse = 0;
+    if (*opts == '!') { Sort.reverse = 1; opts++; }
+    for (; *opts; opts++) {
+        if (*opts == 'n') Sort.numeric = 1;
+        else if (*opts == 'r') Sort.reverse = 1;
+        else if (*opts == 'u') unique = 1;
+        else if (*opts == 'k') { char *e; field = strtoul(opts + 1, &e, 10); opts = e - 1; }
+        else if (*opts != ' ') { v_message(&State.v, "uso: :sort[!] [n] [r] [u] [k N]"); return; }
+    }
+    size_t start, end, n = last - first + 1;
+    const char *base = bulk_begin(first, last, &start, &end);
+    sort_line_t *lines = malloc(sizeof(sort_line_t) * n), *tmp = malloc(sizeof(sort_line_t) * n);
+    for (size_t i = 0; i < n; i++) {
+        sort_line_t *d = &lines[i];
+        d->len = bulk_line(base, start, first + i, &d->off);
+        const char *t = base + d->off;
+        size_t k = 0;
+        // Campo N: pula N-1 campos separados por brancos, como o sort -k
+        for (size_t f = 1; f < field; f++) {
+            while (k < d->len && isspace((unsigned char)t[k])) k++;
+            while (k < d->len && !isspace((unsigned char)t[k])) k++;
+        }
+        if (field > 1) while (k < d->len && isspace((unsigned char)t[k])) k++;
+        d->key = k;
+        if (!Sort.numeric) {
+            d->head = 0;
+            for (size_t b = 0; b < 8; b++) d->head = d->head << 8 | (k + b < d->len ? (unsigned char)t[k + b] : 0);
+            continue;
+        }
+        while (k < d->len && !isdigit((unsigned char)t[k])) k++;
+        if (k == d->len) { d->num = -HUGE_VAL; continue; }
+        int neg = k > 0 && t[k - 1] == '-';
+        double v = 0;
+        while (k < d->len && isdigit((unsigned char)t[k])) v = v * 10 + (t[k++] - '0');
+        d->num = neg ? -v : v;
+    }
+    Sort.base = base;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    sort_job_t job = { lines, tmp, n, cpus > 1 ? (int)cpus : 1 };
+    sort_run(&job);
+    size_t kept = n;
+    if (unique) {
+        kept = n ? 1 : 0;
+        for (size_t i = 1; i < n; i++) if (sort_cmp(&lines[kept - 1], &lines[i]) != 0) lines[kept++] = lines[i];
+    }
+    size_t len;
+    char *out = bulk_join(base, lines, kept, end > start && base[end - 1 - start] == '\n', &len);
+    bulk_replace(start, end, out, len);
+    free(out); free(lines); free(tmp);
+    if (kept < n) v_message(&State.v, "%zu linhas ordenadas, %zu repetidas removidas", n, n - kept);
+    else v_message(&State.v, "%zu linhas ordenadas", n);
+}
+
+// :g/padrão/d apaga as linhas que contêm o padrão; :v/padrão/d (ou :g!) as que não contêm
+static void global_command(const char *cmd, size_t first, size_t last) {
+    int keep_match = *cmd++ == 'v';
+    if (*cmd == '!') { keep_match = !keep_match; cmd++; }
+    char delim = *cmd;
+    const char *pat = delim ? cmd + 1 : cmd, *pend = delim ? strchr(pat, delim) : NULL;
+    if (!delim || isalnum((unsigned char)delim) || !pend || pend == pat || strcmp(pend + 1, "d") != 0) {
+        v_message(&State.v, "uso: :g/padrão/d ou :v/padrão/d");
+        return;
+    }
+    size_t plen = (size_t)(pend - pat), start, end, n = last - first + 1, kept = 0;
+    const char *base = bulk_begin(first, last, &start, &end);
+    sort_line_t *lines = malloc(sizeof(sort_line_t) * n);
+    for (size_t i = 0; i < n; i++) {
+        sort_line_t d;
+        d.len = bulk_line(base, start, first + i, &d.off);
+        if ((memmem(base + d.off, d.len, pat, plen) != NULL) == keep_match) lines[kept++] = d;
+    }
+    if (kept < n) {
+        size_t len;
+        char *out = bulk_join(base, lines, kept, end > start && base[end - 1 - start] == '\n', &len);
+        bulk_replace(start, end, out, len);
+        free(out);
+    }
+    free(lines);
+    v_message(&State.v, "%zu linhas apagadas", n - kept);
+}
+
+// :j junta as linhas num espaço, sem os brancos do começo de cada uma; :j! junta como estão
+static void join_command(const char *opts, size_t first, size_t last) {
+    int raw = *opts == '!';
+    if (last == first) last++;
+    if (last > cmd_last_line()) last = cmd_last_line();
+    if (last <= first) return;
+    size_t start, end, n = last - first + 1, o = 0;
+    const char *base = bulk_begin(first, last, &start, &end);
+    char *out = malloc(end - start + n);
+    for (size_t i = 0; i < n; i++) {
+        size_t off, len = bulk_line(base, start, first + i, &off), k = 0;
+        const char *t = base + off;
+        if (i > 0 && !raw) {
+            while (k < len && (t[k] == ' ' || t[k] == '\t')) k++;
+            if (k < len && t[k] != ')' && o > 0 && out[o - 1] != ' ' && out[o - 1] != '\t') out[o++] = ' ';
+        }
+        memcpy(out + o, t + k, len - k);
+        o += len - k;
+    }
+    if (end > start && base[end - 1 - start] == '\n') out[o++] = '\n';
+    bulk_replace(start, end, out, o);
+    free(out);
+}
+
+static int bulk_command(const char *cmd) {
+    size_t first, last;
+    const char *p = cmd_range(cmd, &first, &last);
+    if (!p) return 0;
+    if (p == cmd && (strncmp(p, "sort", 4) == 0 || *p == 'g' || *p == 'v')) { first = 0; last = cmd_last_line(); }
+    if (strncmp(p, "sort", 4) == 0 && (p[4] == '\0' || p[4] == ' ' || p[4] == '!')) sort_command(p + 4, first, last);
+    else if ((*p == 'g' || *p == 'v') && p[1] && !isalnum((unsigned char)p[1])) global_command(p, first, last);
+    else if (*p == 'j' && (p[1] == '\0' || p[1] == '!')) join_command(p + 1, first, last);
+    else return 0;
+    return 1;
+}
+
+// Cada edição do buffer atualiza só o trecho afetado dos caches da interface
+static void on_text_change(void *udata, const editor_change_t *c) {
+    journal_record(c);
+    Watch.changes++;
+    Diff.stale = 1;
+    v_text_changed((v_state_t *)udata, c->offset, c->removed, c->inserted, c->line, c->lines_removed, c->lines_inserted);
+}
+
+// Realce de sintaxe das linhas fora da tela e contagem das ocorrências da busca
+static int background_job(void *udata) {
+    (void)udata;
+    int r = v_background(&State.v);
+    if (r & V_BG_REDRAW) needs_render = 1;
+    return r & V_BG_MORE;
+}
+
+// --- Buffers (:e arquivo, :bn, :bp, :b N, :ls) ---
+// O buffer da tela vive em State, Journal, Session e Watch como se fosse o único; os
+// outros ficam guardados na lista. Trocar de buffer troca essas structs com a posição
+// dele na lista (a posição do buffer da tela fica zerada), então custa O(1) qualquer
+// que seja o tamanho dos arquivos. Cada buffer leva texto, desfazer, cursor, vista,
+// marcas, realce, journal e imagem de sessão; registradores e macros são de todos.
+// Ao sair da tela o journal vai para o disco, e ao voltar o arquivo é comparado com a
+// versão que o buffer conhece, como o inotify faria se estivesse observando.
+
+typedef struct {
+    editor_t ed;
+    char filename[FILENAME_SIZE];
+    const syntax_lang_t *lang;
+    v_buffer_t view;
+    __typeof__(Journal) journal;
+    __typeof__(Session) session;
+    __typeof__(Watch) watch; // Menos o fd, que é de todos
+} buffer_t;
+
+static struct {
+    buffer_t *list;
+    size_t count, cap;
+    size_t current;
+} Buffers;
+
+#define SWAP(a, b) do { __typeof__(a) t_ = (a); (a) = (b); (b) = t_; } while (0)
+
+// Troca o buffer da tela pelo guardado em b
+static void buffer_exchange(buffer_t *b) {
+    char name[FILENAME_SIZE];
+    memcpy(name, State.filename, FILENAME_SIZE);
+    memcpy(State.filename, b->filename, FILENAME_SIZE);
+    memcpy(b->filename, name, FILENAME_SIZE);
+    SWAP(State.ed, b->ed);
+    SWAP(State.lang, b->lang);
+    SWAP(Journal, b->journal);
+    SWAP(Session, b->session);
+    SWAP(Watch, b->watch);
+    SWAP(Watch.fd, b->watch.fd);
+    v_buffer_swap(&State.v, &b->view);
+}
+
+static void buffer_switch(size_t i) {
+    if (i == Buffers.current) return;
+    journal_sync();
+    diff_cancel();
+    if (Watch.wd >= 0) { inotify_rm_watch(Watch.fd, Watch.wd); Watch.wd = -1; }
+    buffer_exchange(&Buffers.list[i]);
+    SWAP(Buffers.list[i], Buffers.list[Buffers.current]);
+    Buffers.current = i;
+    if (watch_dir(State.filename) && watch_disk_changed()) watch_changed();
+    if (State.v.syntax) idle_schedule(background_job, NULL);
+}
+
+// Lê filename no buffer da tela, recém-criado (registers: ver session_open)
+static void buffer_read(const char *filename, int registers) {
+    snprintf(State.filename, FILENAME_SIZE, "%s", filename);
+    int image = filename[0] && session_open(State.filename, registers);
+    if (!image && (!filename[0] || !editor_load_file(&State.ed, State.filename)))
+        editor_init(&State.ed, INITIAL_ED_CAP);
+    long recovered = journal_open(State.filename);
+    watch_open(State.filename);
+    // O que não está no disco conta como edição: [+], e o disco mudando vira conflito
+    if ((image || recovered > 0) && watch_text_differs()) Watch.changes = recovered > 0 ? (size_t)recovered : 1;
+    editor_set_observer(&State.ed, on_text_change, &State.v);
+
+    char first_line[128];
+    size_t fl = editor_copy_range(&State.ed, 0, sizeof(first_line), first_line);
+    State.lang = syntax_detect(State.filename, first_line, fl);
+    State.v.syntax = State.lang != NULL;
+    if (State.v.syntax) idle_schedule(background_job, NULL);
+}
+
+// Nome, linhas e posição na lista do buffer da tela, se nada mais precisa ser avisado
+static void buffer_info(void) {
+    if (State.v.message[0]) return;
+    v_message(&State.v, "\"%s\"%s %zu linhas [%zu/%zu]", State.filename[0] ? State.filename : "[sem nome]",
+              Watch.changes ? " [+]" : "", editor_line_count(&State.ed), Buffers.current + 1, Buffers.count);
+}
+
+// :e arquivo — vai para o buffer do arquivo, abrindo um novo se preciso
+static void buffer_edit(const char *filename) {
+    while (*filename == ' ') filename++;
+    if (!*filename) { v_message(&State.v, "uso: :e arquivo"); return; }
+    size_t i = 0;
+    while (i < Buffers.count && strcmp(i == Buffers.current ? State.filename : Buffers.list[i].filename, filename) != 0) i++;
+    if (i < Buffers.count) { buffer_switch(i); buffer_info(); return; }
+    if (Buffers.count == Buffers.cap) {
+        Buffers.cap = Buffers.cap ? Buffers.cap * 2 : 8;
+        Buffers.list = realloc(Buffers.list, sizeof(buffer_t) * Buffers.cap);
+    }
+    buffer_t *b = &Buffers.list[Buffers.count];
+    memset(b, 0, sizeof(*b));
+    b->journal.fd = -1;
+    b->watch.wd = -1;
+    buffer_switch(Buffers.count++);
+    buffer_read(filename, 0);
+    buffer_info();
+}
+
+// :ls — numa linha: número, % no buffer da tela, + se há edições não gravadas
+static void buffer_list(void) {
+    char msg[sizeof(State.v.message)];
+    size_t n = 0;
+    msg[0] = '\0';
+    for (size_t i = 0; i < Buffers.count && n < sizeof(msg); i++) {
+        int here = i == Buffers.current;
+        const char *name = here ? State.filename : Buffers.list[i].filename;
+        size_t changes = here ? Watch.changes : Buffers.list[i].watch.changes;
+        n += (size_t)snprintf(msg + n, sizeof(msg) - n, "%s%zu%s \"%s\"%s", i ? "  " : "", i + 1, here ? "%" : "",
+                              name[0] ? name : "[sem nome]", changes ? " +" : "");
+    }
+    v_message(&State.v, "%s", msg);
+}
+
+static int buffer_command(const char *cmd) {
+    if (strncmp(cmd, "e ", 2) == 0) { buffer_edit(cmd + 2); return 1; }
+    if (strcmp(cmd, "ls") == 0) { buffer_list(); return 1; }
+    size_t i;
+    if (strcmp(cmd, "bn") == 0) i = (Buffers.current + 1) % Buffers.count;
+    else if (strcmp(cmd, "bp") == 0) i = (Buffers.current + Buffers.count - 1) % Buffers.count;
+    else if (strncmp(cmd, "b ", 2) == 0) {
+        long n = atol(cmd + 2);
+        if (n < 1 || (size_t)n > Buffers.count) { v_message(&State.v, "não existe esse buffer"); return 1; }
+        i = (size_t)n - 1;
+    } else return 0;
+    buffer_switch(i);
+    buffer_info();
+    return 1;
+}
+
+// :q fecha todos os buffers: grava as imagens de sessão em uso e descarta os journals
+static void buffers_quit(void) {
+    for (size_t i = 0; i < Buffers.count; i++) {
+        int other = i != Buffers.current;
+        if (other) buffer_exchange(&Buffers.list[i]);
+        if (Session.active) session_save();
+        Journal.discard = 1;
+        if (other) { journal_close(); buffer_exchange(&Buffers.list[i]); }
+    }
+}
+
+// Consome todas as teclas já disponíveis, sem desenhar entre elas
+static void process_pending_input(void) {
+    while (in_len > 0 && State.v.running) {
+        int key = input_next_key();
+        if (key < 0) continue;
+        if (key == 127 || key == 8) key = V_KEY_BACKSPACE;
+        if (key == 13 || key == 10) key = V_KEY_ENTER;
+        STATS_TIME(ST_KEY, v_process_key(&State.v, key));
+    }
+    needs_render = 1;
+    journal_tick();
+    if (State.v.syntax || State.v.search.qlen) idle_schedule(background_job, NULL);
 }
 
 int main(int argc, char **argv) {
     v_init(&State.v);
     State.v.udata = &State;
-    if (argc > 1) {
-        strncpy(State.filename, argv[1], FILENAME_SIZE - 1);
-        if (!editor_load_file(&State.ed, State.filename)) editor_init(&State.ed, INITIAL_ED_CAP);
-    } else editor_init(&State.ed, INITIAL_ED_CAP);
+    Buffers.cap = 8;
+    Buffers.list = calloc(Buffers.cap, sizeof(buffer_t));
+    Buffers.count = 1;
+    buffer_read(argc > 1 ? argv[1] : "", 1);
 
     struct winsize w; ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
     State.v.screen_rows = w.ws_row; State.v.screen_cols = w.ws_col;
 
+#ifdef V_STATS
+    // V_TRACE=arquivo.json: eventos do editor.h no formato do chrome://tracing
+    if (getenv("V_TRACE")) editor_trace_open(getenv("V_TRACE"));
+#endif
+    const char *keylog_path = getenv("V_KEYLOG");
+    // Sem buffer: o log fica completo mesmo se o editor morrer
+    if (keylog_path && (keylog = fopen(keylog_path, "wb"))) setvbuf(keylog, NULL, _IONBF, 0);
+
+    setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUF_SIZE);
     enable_raw_mode();
+
+    // Laço de eventos: drena a entrada, desenha no máximo uma vez por quadro,
+    // e usa o tempo ocioso para os jobs de fundo
+    const long long frame_us = FRAME_RATE_CAP > 0 ? 1000000 / FRAME_RATE_CAP : 0;
+    long long next_frame = 0;
     while (State.v.running) {
-        v_render(&State.v);
-        char c;
-        if (read(STDIN_FILENO, &c, 1) > 0) {
-            int key = (unsigned char)c;
-            if (key == 127 || key == 8) key = V_KEY_BACKSPACE;
-            if (key == 13 || key == 10) key = V_KEY_ENTER;
-            v_process_key(&State.v, key);
+        long long now = now_us();
+        if (needs_render && now >= next_frame) {
+            STATS_TIME(ST_RENDER, v_render(&State.v));
+            STATS_TIME(ST_FLUSH, fflush(stdout));
+            needs_render = 0;
+            next_frame = now + frame_us;
         }
+
+        int timeout = POLL_TIMEOUT;
+        if (needs_render) timeout = (int)((next_frame - now + 999) / 1000);
+        else if (idle_has_work()) timeout = 0;
+        if (timeout < 0) timeout = 0;
+
+        if (input_fill(timeout)) process_pending_input();
+        else if (!needs_render && idle_has_work()) idle_run(IDLE_SLICE_US);
+        else journal_tick();
     }
+    journal_close();
+    stats_dump();
+#ifdef V_STATS
+    editor_trace_close();
+#endif
+    v_free(&State.v);
+    if (keylog) fclose(keylog);
     return 0;
 }
@@ -22,22 +22,170 @@ extern "C" {
 
 typedef enum { V_MODE_NORMAL, V_MODE_INSERT, V_MODE_COMMAND, V_MODE_SEARCH, V_MODE_VISUAL } v_mode_t;
 
+#define V_LN_WIDTH       4    // Largura da coluna de números de linha
+#define V_LAYOUT_WINDOW  256  // Linhas com layout em cache ao redor do viewport
+
+typedef struct {
+    size_t width;    // Largura da linha em colunas de tela
+    size_t memo_pos; // Último par (byte relativo ao início da linha, coluna) calculado,
+    size_t memo_col; // para que movimentos curtos não reescaneiem a linha
+    int valid;
+} v_line_info_t;
+
+typedef struct {
+    size_t base; // Primeira linha coberta pela janela
+    v_line_info_t lines[V_LAYOUT_WINDOW];
+} v_layout_t;
+
+// Cache de realce de sintaxe: estado do lexer no fim de cada linha
+typedef struct {
+    unsigned char *states;
+    size_t cap;
+    size_t valid;   // Linhas [0, valid) têm estado correto
+    size_t known;   // Linhas [0, known) já foram analisadas (podem estar desatualizadas além de valid)
+    size_t resync;  // A reanálise só pode convergir a partir desta linha (fim da última edição)
+    char *text;     // Buffers de trabalho para a linha sendo analisada
+    unsigned char *cls;
+    size_t text_cap;
+    int approx;     // A tela foi desenhada com um estado de entrada aproximado
+} v_highlight_t;
+
+#define V_NOT_FOUND ((size_t)-1)
+#define V_MARKS     28 // a-z, < e >
+
+// Busca ativa: posições ordenadas de todas as ocorrências que começam em [0, scanned)
+typedef struct {
+    char query[256];
+    size_t qlen;     // 0 = sem busca ativa
+    int forward;     // Direção da última busca (/ ou ?)
+    int hidden;      // :noh esconde o destaque até a próxima busca
+    size_t *pos;
+    size_t count, cap;
+    size_t scanned;  // Até onde o texto já foi varrido
+    size_t origin;   // Cursor ao entrar no modo de busca
+} v_search_t;
+
+// Texto de um registrador. O mesmo bloco é compartilhado (por contagem de
+// referências) entre o registrador sem nome, o anel numerado e os nomeados.
+typedef struct {
+    size_t refs;
+    size_t len;
+    int linewise;
+    char data[];
+} v_blob_t;
+
+// "" (0), "a-"z (1-26), "0-"9 (27-36) e "- (37)
+#define V_REGISTERS 38
+
+// Marca de diferença: as linhas [line, line + count) foram acrescentadas ('+') ou
+// mudaram ('~'); '-' marca a linha logo depois de linhas removidas (count 1)
+typedef struct {
+    size_t line, count;
+    int kind;
+} v_diff_mark_t;
+
+// Sequência de teclas gravada (teclas >= 255 viram 0xFF, byte alto, byte baixo)
+typedef struct {
+    char *data;
+    size_t len, cap;
+} v_keys_t;
+
+// Retorno de v_background
+#define V_BG_MORE   1 // Ainda há trabalho de fundo
+#define V_BG_REDRAW 2 // O trabalho feito muda o que está na tela
+
 typedef struct {
     v_mode_t mode;
     char command_buffer[256];
     char search_buffer[256];
+    char message[256]; // Aviso na barra de status até a próxima tecla
     int running;
     int pending_d, pending_g, pending_y;
+    int pending_name; // m ` ' q @ esperando o nome da marca/registrador
+    int count;        // Contador digitado antes do comando (0 = nenhum)
+    int prefix;       // A última tecla só preparou o comando (contador, "x, operador)
     int screen_rows, screen_cols;
     int row_offset;
+    int row_skip;    // Linhas de tela de row_offset escondidas acima do topo (wrap)
+    int col_offset;  // Rolagem horizontal (sem wrap)
+    int wrap;
+    int tabstop;
+    int want_col;    // Coluna visual desejada em movimentos verticais (-1 = posição atual)
+    int keep_col;
+    int cursor_x, cursor_y;
+    v_layout_t layout;
+    int syntax;      // Realce ligado (o host define V_SYN_LEX)
+    v_highlight_t hl;
+    v_search_t search;
+    size_t marks[V_MARKS];
+    unsigned marks_set;
+    v_blob_t *regs[V_REGISTERS];
+    int reg;         // Registrador escolhido com "x (0 = nenhum, '"' = esperando o nome)
+    v_keys_t cmd;    // Teclas do comando em andamento
+    v_keys_t dot;    // Teclas da última mudança, repetidas pelo '.' (sem o contador)
+    int cmd_count;   // Contador do comando em andamento, fora de cmd
+    int dot_count;   // Contador do '.' (0 = nenhum)
+    int cmd_changed; // O comando em andamento editou o texto
+    int cmd_repeat;  // O comando em andamento não vira o novo '.' ('.', '@', 'u', ':')
+    v_keys_t ins;    // Teclas digitadas na inserção em andamento
+    int ins_count;   // Contador do i/a/o/O: a inserção (gravada se > 1) se repete no ESC
+    int ins_line;    // A inserção veio do o/O: cada repetição abre uma linha
+    v_keys_t macro;  // Gravação em andamento (q)
+    int macro_reg;   // Registrador da gravação (0 = sem gravação)
+    int last_macro;  // Para o @@
+    v_diff_mark_t *diff; // Marcas do último :diff, em ordem (somem na próxima edição)
+    size_t diff_count;
+    int replaying;   // Profundidade de reprodução ('.' ou '@'): não grava teclas
+    int batch;       // > 0: as edições entram num único grupo de desfazer
     size_t visual_anchor; 
     int insert_return; // Flag para o Ctrl+O retornar ao modo inserção
     void *udata; 
 } v_state_t;
 
+// O que é de cada buffer quando o host edita vários: vista, marcas, realce e :diff.
+// Registradores, '.', macros e a última busca são de todos.
+typedef struct {
+    int row_offset, row_skip, col_offset;
+    size_t marks[V_MARKS];
+    unsigned marks_set;
+    int syntax;
+    v_highlight_t hl;
+    v_diff_mark_t *diff;
+    size_t diff_count;
+} v_buffer_t;
+
 void v_init(v_state_t *v);
 void v_process_key(v_state_t *v, int c);
 void v_render(v_state_t *v);
+// Entrega um bloco colado (bracketed paste) como uma única inserção
+void v_paste(v_state_t *v, const char *text, size_t len);
+// Uma fatia de trabalho de fundo (realce fora da tela, contagem da busca). Retorna V_BG_MORE / V_BG_REDRAW.
+int v_background(v_state_t *v);
+// Libera os caches alocados
+void v_free(v_state_t *v);
+// Mostra um aviso na barra de status (some na próxima tecla), formatado como no printf
+#ifdef __GNUC__
+__attribute__((format(printf, 2, 3)))
+#endif
+void v_message(v_state_t *v, const char *fmt, ...);
+// O host avisa cada edição: o texto [offset, offset + removed) virou
+// [offset, offset + inserted), e as linhas [line, line + lines_removed]
+// viraram [line, line + lines_inserted]
+void v_text_changed(v_state_t *v, size_t offset, size_t removed, size_t inserted,
+                    size_t line, size_t lines_removed, size_t lines_inserted);
+// Serializa a vista, as marcas, os registradores e o '.' para uma imagem de sessão.
+// Com out NULL só mede. Retorna o tamanho.
+size_t v_session_save(const v_state_t *v, char *out);
+// Restaura o que v_session_save gravou. Retorna 0 se os dados estão truncados.
+int v_session_load(v_state_t *v, const char *data, size_t len);
+// Mostra marcas de diferença na coluna de números (n = 0 apaga). ]c e [c pulam entre elas.
+void v_diff_set(v_state_t *v, const v_diff_mark_t *marks, size_t n);
+// Troca o buffer da tela pelo guardado em b, que fica com o que estava na tela. O(1):
+// os caches mudam de dono, nada é copiado. Um b zerado é um buffer novo. O host troca
+// o texto junto; a contagem da busca recomeça no texto novo.
+void v_buffer_swap(v_state_t *v, v_buffer_t *b);
+// Libera os caches guardados em b
+void v_buffer_free(v_buffer_t *b);
 
 #ifdef __cplusplus
 }
@@ -49,6 +197,21 @@ void v_render(v_state_t *v);
 
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+#ifndef V_REALLOC
+#define V_REALLOC(p, sz) realloc(p, sz)
+#endif
+#ifndef V_FREE
+#define V_FREE(p) free(p)
+#endif
+
+#define V_HL_MAX_LINE   16384 // Bytes analisados por linha (o resto fica sem realce)
+#define V_HL_SYNC_LINES 2000  // Distância máxima analisada na hora antes do viewport
+#define V_HL_SLICE      4000  // Linhas por fatia de trabalho de fundo
+#define V_SEARCH_SLICE  (1 << 20) // Bytes varridos por fatia de busca
+#define V_REPLAY_DEPTH  32        // Macros chamando macros
 
 #define V_EXPAND(key, action) case key: action; break;
 #define V(key, action) case key: action; break;
@@ -69,10 +232,10 @@ void v_render(v_state_t *v);
 #define V_ACTION_CUSTOM(v, c)
 #endif
 #ifndef V_ACTION_COMMAND
-#define V_ACTION_COMMAND(v, cmd)
+#define V_ACTION_COMMAND(v, cmd) do {} while (0)
 #endif
 #ifndef V_ACTION_MOVE_LINE
-#define V_ACTION_MOVE_LINE(v, dir)
+#define V_ACTION_MOVE_LINE(v, dir) v_move_line(v, dir)
 #endif
 
 // --- PRIMITIVAS TERMINAL ---
@@ -85,6 +248,9 @@ void v_render(v_state_t *v);
 #ifndef V_TERM_CURSOR_SHOW
 #define V_TERM_CURSOR_SHOW(show)
 #endif
+#ifndef V_TERM_FLUSH
+#define V_TERM_FLUSH() fflush(stdout) // O host pode esvaziar a saída por conta própria
+#endif
 #ifndef V_CLR_RESET
 #define V_CLR_RESET()
 #endif
@@ -97,9 +263,18 @@ void v_render(v_state_t *v);
 #ifndef V_CLR_TEXT
 #define V_CLR_TEXT()
 #endif
+#ifndef V_CLR_SYNTAX
+#define V_CLR_SYNTAX(cls) // Deve mudar só a cor de frente
+#endif
 #ifndef V_CLR_SELECTION
 #define V_CLR_SELECTION()
 #endif
+#ifndef V_CLR_MATCH
+#define V_CLR_MATCH() // Fundo das ocorrências da busca
+#endif
+#ifndef V_CLR_DIFF
+#define V_CLR_DIFF(kind) // Marca '+', '~' ou '-' do :diff
+#endif
 
 // --- PRIMITIVAS EDITOR ---
 #ifndef V_ED_GET_CURSOR
@@ -120,6 +295,9 @@ void v_render(v_state_t *v);
 #ifndef V_ED_INSERT_TEXT
 #define V_ED_INSERT_TEXT(v, text)
 #endif
+#ifndef V_ED_INSERT_BYTES
+#define V_ED_INSERT_BYTES(v, text, len)
+#endif
 #ifndef V_ED_SAVE_SNAPSHOT
 #define V_ED_SAVE_SNAPSHOT(v)
 #endif
@@ -135,23 +313,748 @@ void v_render(v_state_t *v);
 #ifndef V_ED_GET_ROW_COL
 #define V_ED_GET_ROW_COL(v, pos, r, c)
 #endif
-#ifndef V_ED_YANK
-#define V_ED_YANK(v, start, end)
+#ifndef V_ED_COPY_RANGE
+#define V_ED_COPY_RANGE(v, start, end, dst) do { for (size_t _i = (start); _i < (end); _i++) (dst)[_i - (start)] = V_ED_GET_CHAR(v, _i); } while (0)
 #endif
-#ifndef V_ED_PASTE
-#define V_ED_PASTE(v)
+#ifndef V_SYN_LEX
+#define V_SYN_LEX(v, state, text, len, out) 0
 #endif
-#ifndef V_ED_SEARCH
-#define V_ED_SEARCH(v, query, forward)
+#ifndef V_ED_LINE_COUNT
+#define V_ED_LINE_COUNT(v) 1
 #endif
+#ifndef V_ED_LINE_OFFSET
+#define V_ED_LINE_OFFSET(v, line) 0
+#endif
+#ifndef V_ED_LINE_OF
+#define V_ED_LINE_OF(v, pos) 0
+#endif
+// V_ED_FIND(v, query, qlen, start, end): primeira ocorrência começando em
+// [start, end), ou V_NOT_FOUND. Sem ele a busca usa V_ED_GET_CHAR.
+
+// --- LAYOUT ---
+// Largura (em colunas) de cada linha, guardada numa janela de linhas consecutivas
+// em torno do viewport. Edições deslocam a janela e invalidam só as linhas tocadas.
+
+static int v_text_cols(v_state_t *v) {
+    int w = v->screen_cols - V_LN_WIDTH;
+    return w > 0 ? w : 1;
+}
+
+static size_t v_line_end(v_state_t *v, size_t line) {
+    return (line + 1 < V_ED_LINE_COUNT(v)) ? V_ED_LINE_OFFSET(v, line + 1) - 1 : V_ED_GET_LENGTH(v);
+}
+
+// Largura de um byte na coluna col: tabs vão até a próxima parada, controles
+// viram ^X, e bytes de continuação UTF-8 não ocupam coluna
+static size_t v_char_width(v_state_t *v, unsigned char c, size_t col) {
+    if (c == '\t') return (size_t)v->tabstop - col % (size_t)v->tabstop;
+    if (c < 0x20 || c == 0x7f) return 2;
+    if ((c & 0xC0) == 0x80) return 0;
+    return 1;
+}
+
+static size_t v_display_col(v_state_t *v, size_t line, size_t pos);
+
+static void v_layout_reset(v_state_t *v) {
+    memset(v->layout.lines, 0, sizeof(v->layout.lines));
+}
+
+// Garante que line está dentro da janela, recentrando-a se preciso
+static v_line_info_t *v_layout_slot(v_state_t *v, size_t line) {
+    v_layout_t *lay = &v->layout;
+    if (line < lay->base || line >= lay->base + V_LAYOUT_WINDOW) {
+        size_t nb = line > V_LAYOUT_WINDOW / 2 ? line - V_LAYOUT_WINDOW / 2 : 0;
+        if (nb < lay->base && lay->base - nb < V_LAYOUT_WINDOW) {
+            size_t d = lay->base - nb;
+            memmove(lay->lines + d, lay->lines, sizeof(v_line_info_t) * (V_LAYOUT_WINDOW - d));
+            memset(lay->lines, 0, sizeof(v_line_info_t) * d);
+        } else if (nb > lay->base && nb - lay->base < V_LAYOUT_WINDOW) {
+            size_t d = nb - lay->base;
+            memmove(lay->lines, lay->lines + d, sizeof(v_line_info_t) * (V_LAYOUT_WINDOW - d));
+            memset(lay->lines + V_LAYOUT_WINDOW - d, 0, sizeof(v_line_info_t) * d);
+        } else {
+            v_layout_reset(v);
+        }
+        lay->base = nb;
+    }
+    return &lay->lines[line - lay->base];
+}
+
+static v_line_info_t *v_line_info(v_state_t *v, size_t line) {
+    v_line_info_t *li = v_layout_slot(v, line);
+    if (!li->valid) {
+        li->valid = 1;
+        li->memo_pos = li->memo_col = 0;
+        li->width = v_display_col(v, line, v_line_end(v, line));
+    }
+    return li;
+}
+
+static size_t v_line_width(v_state_t *v, size_t line) {
+    return v_line_info(v, line)->width;
+}
+
+// Coluna de tela da posição pos na linha line. Continua a partir do último
+// cálculo feito na mesma linha quando possível.
+static size_t v_display_col(v_state_t *v, size_t line, size_t pos) {
+    size_t start = V_ED_LINE_OFFSET(v, line);
+    v_line_info_t *li = v_line_info(v, line);
+    size_t i = 0, col = 0;
+    if (li->memo_pos <= pos - start) { i = li->memo_pos; col = li->memo_col; }
+    for (; start + i < pos; i++) col += v_char_width(v, (unsigned char)V_ED_GET_CHAR(v, start + i), col);
+    li->memo_pos = i; li->memo_col = col;
+    return col;
+}
+
+// Posição na linha line cuja coluna de tela contém col (ou o fim da linha)
+static size_t v_pos_at_col(v_state_t *v, size_t line, size_t col) {
+    size_t start = V_ED_LINE_OFFSET(v, line), end = v_line_end(v, line);
+    v_line_info_t *li = v_line_info(v, line);
+    size_t i = 0, c = 0;
+    if (li->memo_col <= col) { i = li->memo_pos; c = li->memo_col; }
+    while (start + i < end) {
+        size_t w = v_char_width(v, (unsigned char)V_ED_GET_CHAR(v, start + i), c);
+        if (c + w > col && w > 0) break;
+        c += w; i++;
+    }
+    li->memo_pos = i; li->memo_col = c;
+    return start + i;
+}
+
+// j/k: mantém a coluna visual entre linhas de tamanhos e tabs diferentes
+static void v_move_line(v_state_t *v, int dir) {
+    size_t cur = V_ED_GET_CURSOR(v), line = V_ED_LINE_OF(v, cur);
+    v->keep_col = 1;
+    if (dir < 0 && line == 0) return;
+    if (dir > 0 && line + 1 >= V_ED_LINE_COUNT(v)) return;
+    if (v->want_col < 0) v->want_col = (int)v_display_col(v, line, cur);
+    V_ED_SET_CURSOR(v, v_pos_at_col(v, dir > 0 ? line + 1 : line - 1, (size_t)v->want_col));
+}
+
+// Quantas linhas de tela a linha ocupa
+static size_t v_line_rows(v_state_t *v, size_t line) {
+    if (!v->wrap) return 1;
+    size_t w = v_line_width(v, line), cols = (size_t)v_text_cols(v);
+    return w == 0 ? 1 : (w + cols - 1) / cols;
+}
+
+// As linhas [line, line + old_count) viraram [line, line + new_count)
+static void v_layout_lines_changed(v_state_t *v, size_t line, size_t old_count, size_t new_count) {
+    v_layout_t *lay = &v->layout;
+    size_t end = lay->base + V_LAYOUT_WINDOW;
+    if (line >= end) return;
+    if (line + old_count <= lay->base && old_count == new_count) return;
+    if (line < lay->base) { v_layout_reset(v); return; }
+    size_t i = line - lay->base;
+    size_t tail_old = i + old_count, tail_new = i + new_count;
+    if (tail_old < V_LAYOUT_WINDOW && tail_new < V_LAYOUT_WINDOW) {
+        size_t keep = V_LAYOUT_WINDOW - (tail_old > tail_new ? tail_old : tail_new);
+        memmove(lay->lines + tail_new, lay->lines + tail_old, sizeof(v_line_info_t) * keep);
+        if (tail_new < tail_old) memset(lay->lines + tail_new + keep, 0, sizeof(v_line_info_t) * (tail_old - tail_new));
+    } else {
+        tail_new = V_LAYOUT_WINDOW;
+    }
+    if (tail_new > V_LAYOUT_WINDOW) tail_new = V_LAYOUT_WINDOW;
+    memset(lay->lines + i, 0, sizeof(v_line_info_t) * (tail_new - i));
+}
+
+// --- REALCE DE SINTAXE ---
+// O estado no fim de cada linha fica em cache. Depois de uma edição a análise
+// recomeça na linha editada e para assim que o estado volta a bater com o cache.
+// Só o viewport é analisado na hora; o resto fica para v_background.
+
+static void v_hl_reserve(v_state_t *v, size_t n) {
+    v_highlight_t *hl = &v->hl;
+    if (n <= hl->cap) return;
+    size_t cap = hl->cap ? hl->cap * 2 : 1024;
+    if (cap < n) cap = n;
+    hl->states = (unsigned char *)V_REALLOC(hl->states, cap);
+    hl->cap = cap;
+}
+
+// Analisa a linha e retorna o estado no fim dela. Com paint, hl->cls recebe a
+// classe de cada byte analisado; *n recebe quantos bytes foram analisados.
+static int v_hl_lex(v_state_t *v, size_t line, int state, int paint, size_t *n) {
+    v_highlight_t *hl = &v->hl;
+    size_t start = V_ED_LINE_OFFSET(v, line), end = v_line_end(v, line);
+    size_t len = end - start;
+    if (len > V_HL_MAX_LINE) len = V_HL_MAX_LINE;
+    if (len > hl->text_cap) {
+        hl->text_cap = len * 2;
+        hl->text = (char *)V_REALLOC(hl->text, hl->text_cap);
+        hl->cls = (unsigned char *)V_REALLOC(hl->cls, hl->text_cap);
+    }
+    V_ED_COPY_RANGE(v, start, start + len, hl->text);
+    if (n) *n = len;
+    (void)state; (void)paint;
+    return V_SYN_LEX(v, state, hl->text, len, paint ? hl->cls : NULL);
+}
+
+// Garante estados corretos para as linhas [0, upto)
+static void v_hl_advance(v_state_t *v, size_t upto) {
+    v_highlight_t *hl = &v->hl;
+    size_t n = V_ED_LINE_COUNT(v);
+    if (upto > n) upto = n;
+    if (hl->known > n) hl->known = n;
+    if (hl->valid > n) hl->valid = n;
+    v_hl_reserve(v, upto);
+    while (hl->valid < upto) {
+        size_t idx = hl->valid;
+        unsigned char out = (unsigned char)v_hl_lex(v, idx, idx ? hl->states[idx - 1] : 0, 0, NULL);
+        int converged = idx < hl->known && idx + 1 >= hl->resync && hl->states[idx] == out;
+        hl->states[idx] = out;
+        hl->valid = idx + 1;
+        if (hl->known < hl->valid) hl->known = hl->valid;
+        if (converged) hl->valid = hl->known;
+        if (hl->valid >= hl->resync) hl->resync = 0;
+    }
+}
+
+static void v_hl_lines_changed(v_state_t *v, size_t line, size_t old_count, size_t new_count) {
+    v_highlight_t *hl = &v->hl;
+    size_t old_valid = hl->valid;
+    if (hl->valid > line) hl->valid = line;
+    if (hl->known <= line) return;
+    size_t old_end = line + old_count, new_end = line + new_count;
+    if (old_end >= hl->known) { hl->known = line; return; }
+    // Desloca os estados depois da edição e guarda, na última linha editada, o estado
+    // antigo que entrava na primeira linha intacta (é com ele que a reanálise compara)
+    unsigned char boundary = hl->states[old_end - 1];
+    size_t tail = hl->known - old_end;
+    v_hl_reserve(v, new_end + tail);
+    memmove(hl->states + new_end, hl->states + old_end, tail);
+    hl->states[new_end - 1] = boundary;
+    hl->known = new_end + tail;
+    if (hl->resync > old_end) hl->resync = hl->resync - old_end + new_end;
+    if (hl->resync < new_end) hl->resync = new_end;
+    // Onde uma reanálise anterior parou, o estado calculado e o antigo não se
+    // encadeiam: também não dá para convergir antes de passar desse ponto
+    if (old_valid >= old_end && old_valid < hl->known - new_end + old_end) {
+        size_t b = old_valid - old_end + new_end + 1;
+        if (hl->resync < b) hl->resync = b;
+    }
+}
+
+static void v_hl_reset(v_state_t *v) {
+    v->hl.valid = v->hl.known = v->hl.resync = 0;
+}
+
+// --- BUSCA ---
+// As ocorrências ficam numa tabela ordenada, completa até scanned. Digitar mais
+// uma letra só filtra a tabela; edições trocam só as ocorrências das linhas
+// editadas. n/N e "i de k" viram buscas binárias.
+
+#ifndef V_ED_FIND
+static size_t v_find_bytes(v_state_t *v, const char *query, size_t qlen, size_t start, size_t end) {
+    size_t len = V_ED_GET_LENGTH(v);
+    if (qlen == 0 || qlen > len) return V_NOT_FOUND;
+    if (end > len - qlen + 1) end = len - qlen + 1;
+    for (size_t i = start; i < end; i++) {
+        size_t j = 0;
+        while (j < qlen && V_ED_GET_CHAR(v, i + j) == query[j]) j++;
+        if (j == qlen) return i;
+    }
+    return V_NOT_FOUND;
+}
+#define V_ED_FIND(v, query, qlen, start, end) v_find_bytes(v, query, qlen, start, end)
+#endif
+
+// Índice da primeira ocorrência >= p
+static size_t v_search_lower(v_search_t *s, size_t p) {
+    size_t lo = 0, hi = s->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (s->pos[mid] < p) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+static void v_search_reserve(v_search_t *s, size_t n) {
+    if (n <= s->cap) return;
+    size_t cap = s->cap ? s->cap * 2 : 256;
+    if (cap < n) cap = n;
+    s->pos = (size_t *)V_REALLOC(s->pos, cap * sizeof(size_t));
+    s->cap = cap;
+}
+
+// Varre [scanned, upto) acrescentando as ocorrências no fim da tabela
+static void v_search_scan(v_state_t *v, size_t upto) {
+    v_search_t *s = &v->search;
+    size_t len = V_ED_GET_LENGTH(v);
+    if (upto > len) upto = len;
+    if (!s->qlen || s->scanned >= upto) return;
+    size_t p = s->scanned;
+    while ((p = V_ED_FIND(v, s->query, s->qlen, p, upto)) != V_NOT_FOUND) {
+        v_search_reserve(s, s->count + 1);
+        s->pos[s->count++] = p++;
+    }
+    s->scanned = upto;
+}
+
+// Troca a consulta. Se a nova só acrescenta letras à antiga, toda ocorrência
+// dela já está na tabela: basta filtrar.
+static void v_search_set(v_state_t *v, const char *query) {
+    v_search_t *s = &v->search;
+    size_t qlen = strlen(query);
+    if (qlen >= sizeof(s->query)) qlen = sizeof(s->query) - 1;
+    int refine = s->qlen > 0 && qlen >= s->qlen && memcmp(query, s->query, s->qlen) == 0;
+    memcpy(s->query, query, qlen); s->query[qlen] = '\0';
+    s->qlen = qlen;
+    s->hidden = 0;
+    if (!refine) { s->count = s->scanned = 0; return; }
+    size_t k = 0;
+    for (size_t i = 0; i < s->count; i++)
+        if (V_ED_FIND(v, s->query, qlen, s->pos[i], s->pos[i] + 1) != V_NOT_FOUND) s->pos[k++] = s->pos[i];
+    s->count = k;
+}
+
+// Ocorrência mais próxima de from: a primeira >= from, ou a última < from.
+// Dá a volta no documento se não houver nenhuma naquela direção.
+static size_t v_search_find(v_state_t *v, size_t from, int forward) {
+    v_search_t *s = &v->search;
+    size_t len = V_ED_GET_LENGTH(v), p;
+    if (!s->qlen) return V_NOT_FOUND;
+    if (forward) {
+        if (from < s->scanned) {
+            size_t i = v_search_lower(s, from);
+            if (i < s->count) return s->pos[i];
+        }
+        // Além do trecho varrido a busca vai direto no texto
+        p = V_ED_FIND(v, s->query, s->qlen, from > s->scanned ? from : s->scanned, len);
+        if (p != V_NOT_FOUND) return p;
+        if (s->count) return s->pos[0];
+        return V_ED_FIND(v, s->query, s->qlen, s->scanned, from);
+    }
+    v_search_scan(v, from);
+    size_t i = v_search_lower(s, from);
+    if (i > 0) return s->pos[i - 1];
+    v_search_scan(v, len);
+    return s->count ? s->pos[s->count - 1] : V_NOT_FOUND;
+}
+
+// Primeira ocorrência em [from, to): pela tabela se o trecho já foi varrido
+static size_t v_search_next_in(v_state_t *v, size_t from, size_t to) {
+    v_search_t *s = &v->search;
+    if (to <= s->scanned) {
+        size_t i = v_search_lower(s, from);
+        return (i < s->count && s->pos[i] < to) ? s->pos[i] : V_NOT_FOUND;
+    }
+    return V_ED_FIND(v, s->query, s->qlen, from, to);
+}
+
+// n / N: forward segue a direção da última busca, !forward vai ao contrário
+static void v_search_jump(v_state_t *v, int forward) {
+    v_search_t *s = &v->search;
+    size_t cur = V_ED_GET_CURSOR(v);
+    int fwd = s->forward ? forward : !forward;
+    size_t p = v_search_find(v, fwd ? cur + 1 : cur, fwd);
+    s->hidden = 0;
+    if (p != V_NOT_FOUND) V_ED_SET_CURSOR(v, p);
+}
+
+// Busca incremental: a cada tecla o cursor vai para a ocorrência mais próxima
+// da posição onde a busca começou
+static void v_search_update(v_state_t *v) {
+    v_search_t *s = &v->search;
+    v_search_set(v, v->search_buffer);
+    size_t p = v_search_find(v, s->forward ? s->origin : s->origin + 1, s->forward);
+    V_ED_SET_CURSOR(v, p != V_NOT_FOUND ? p : s->origin);
+}
+
+// O texto [offset, offset + removed) virou [offset, offset + inserted): as
+// ocorrências que tocavam nele são refeitas e as seguintes só se deslocam
+static void v_search_changed(v_state_t *v, size_t offset, size_t removed, size_t inserted) {
+    v_search_t *s = &v->search;
+    if (!s->qlen) return;
+    size_t old_end = offset + removed, new_end = offset + inserted;
+    size_t from = offset >= s->qlen - 1 ? offset - (s->qlen - 1) : 0;
+    if (s->scanned <= from) return;
+    size_t a = v_search_lower(s, from);
+    if (s->scanned < old_end) { s->count = a; s->scanned = from; return; }
+    size_t b = v_search_lower(s, old_end), fresh = 0, p;
+    for (p = from; (p = V_ED_FIND(v, s->query, s->qlen, p, new_end)) != V_NOT_FOUND; p++) fresh++;
+    v_search_reserve(s, s->count - (b - a) + fresh);
+    memmove(s->pos + a + fresh, s->pos + b, (s->count - b) * sizeof(size_t));
+    s->count = s->count - (b - a) + fresh;
+    for (size_t i = a + fresh; i < s->count; i++) s->pos[i] = s->pos[i] + inserted - removed;
+    for (p = from; (p = V_ED_FIND(v, s->query, s->qlen, p, new_end)) != V_NOT_FOUND; p++) s->pos[a++] = p;
+    s->scanned = s->scanned + inserted - removed;
+}
+
+// --- MARCAS ---
+// a-z pelo usuário, < e > no fim do modo visual. Acompanham as edições.
+
+static int v_mark_index(int c) {
+    if (c >= 'a' && c <= 'z') return c - 'a';
+    if (c == '<') return 26;
+    if (c == '>') return 27;
+    return -1;
+}
+
+static void v_mark_set(v_state_t *v, int i, size_t pos) {
+    v->marks[i] = pos;
+    v->marks_set |= 1u << i;
+}
+
+// m{a-z} marca o cursor; `x vai para a marca, 'x para o início da linha dela
+static void v_mark_key(v_state_t *v, int kind, int c) {
+    int i = v_mark_index(c);
+    if (i < 0) return;
+    if (kind == 'm') { if (i < 26) v_mark_set(v, i, V_ED_GET_CURSOR(v)); return; }
+    if (!(v->marks_set & (1u << i))) return;
+    size_t p = v->marks[i];
+    V_ED_SET_CURSOR(v, kind == '\'' ? V_ED_FIND_LINE_START(v, p) : p);
+}
+
+static void v_marks_changed(v_state_t *v, size_t offset, size_t removed, size_t inserted) {
+    for (int i = 0; i < V_MARKS; i++) {
+        if (!(v->marks_set & (1u << i)) || v->marks[i] <= offset) continue;
+        // Uma marca dentro do trecho removido vai para o início dele
+        v->marks[i] = v->marks[i] >= offset + removed ? v->marks[i] - removed + inserted : offset;
+    }
+}
+
+// Início de um grupo de desfazer. Numa reprodução em lote o grupo é um só.
+static void v_snapshot(v_state_t *v) {
+    if (!v->batch) V_ED_SAVE_SNAPSHOT(v);
+}
+
+static int v_count(v_state_t *v) {
+    return v->count > 0 ? v->count : 1;
+}
+
+#define V_TIMES(v) for (int _n = v_count(v); _n > 0; _n--)
+
+// --- REGISTRADORES ---
+// Um yank copia o texto uma única vez (V_ED_COPY_RANGE) para um bloco imutável;
+// mover o bloco pelo anel ou entre registradores só mexe na contagem de referências,
+// e colar é uma única inserção.
+
+static int v_reg_index(int c) {
+    if (c == '"') return 0;
+    if (c >= 'a' && c <= 'z') return 1 + c - 'a';
+    if (c >= 'A' && c <= 'Z') return 1 + c - 'A';
+    if (c >= '0' && c <= '9') return 27 + c - '0';
+    if (c == '-') return 37;
+    return -1;
+}
+
+static v_blob_t *v_blob_new(size_t len, int linewise) {
+    v_blob_t *b = (v_blob_t *)V_REALLOC(NULL, sizeof(v_blob_t) + len);
+    b->refs = 1; b->len = len; b->linewise = linewise;
+    return b;
+}
+
+static void v_blob_release(v_blob_t *b) {
+    if (b && --b->refs == 0) V_FREE(b);
+}
+
+// Guarda b no registrador i (o registrador passa a ter uma referência própria)
+static void v_reg_store(v_state_t *v, int i, v_blob_t *b) {
+    b->refs++;
+    v_blob_release(v->regs[i]);
+    v->regs[i] = b;
+}
+
+// Copia [start, end) para os registradores: o escolhido com "x ("X acrescenta),
+// o sem nome, e "0 (yank) ou "1-"9 / "- (deleção)
+static void v_yank(v_state_t *v, size_t start, size_t end, int linewise, int deleting) {
+    size_t len = V_ED_GET_LENGTH(v);
+    if (end > len) end = len;
+    if (start >= end) return;
+    // Linhas sempre terminam em '\n', mesmo a última do arquivo
+    int pad = linewise && V_ED_GET_CHAR(v, end - 1) != '\n';
+    int named = v->reg && v->reg != '"' ? v_reg_index(v->reg) : -1;
+    v_blob_t *b;
+    if (named > 0 && v->reg >= 'A' && v->reg <= 'Z' && v->regs[named]) {
+        v_blob_t *old = v->regs[named];
+        b = v_blob_new(old->len + (end - start) + pad, old->linewise || linewise);
+        memcpy(b->data, old->data, old->len);
+        V_ED_COPY_RANGE(v, start, end, b->data + old->len);
+    } else {
+        b = v_blob_new((end - start) + pad, linewise);
+        V_ED_COPY_RANGE(v, start, end, b->data);
+    }
+    if (pad) b->data[b->len - 1] = '\n';
+
+    if (named > 0) v_reg_store(v, named, b);
+    v_reg_store(v, 0, b);
+    if (!deleting) { if (named <= 0) v_reg_store(v, 27, b); }
+    else if (linewise || memchr(b->data, '\n', b->len)) {
+        // Anel numerado: "1 recebe a deleção, o antigo "9 sai
+        v_blob_release(v->regs[36]);
+        memmove(v->regs + 29, v->regs + 28, sizeof(v_blob_t *) * 8);
+        v->regs[28] = NULL;
+        v_reg_store(v, 28, b);
+    } else if (named <= 0) v_reg_store(v, 37, b);
+    v_blob_release(b);
+}
+
+// p (after) / P: linhas vão abaixo/acima da linha do cursor, texto depois/antes
+// dele, count vezes
+static void v_put(v_state_t *v, int after, int count) {
+    int i = v->reg && v->reg != '"' ? v_reg_index(v->reg) : 0;
+    v_blob_t *b = i >= 0 ? v->regs[i] : NULL;
+    if (!b || !b->len) return;
+    size_t cur = V_ED_GET_CURSOR(v), len = V_ED_GET_LENGTH(v), pos;
+    v_snapshot(v);
+    if (b->linewise) {
+        size_t le = V_ED_FIND_LINE_END(v, cur);
+        if (!after) pos = V_ED_FIND_LINE_START(v, cur);
+        else if (le < len) pos = le + 1;
+        else {
+            // Abaixo da última linha, que não termina em '\n'
+            V_ED_SET_CURSOR(v, len);
+            for (int i = 0; i < count; i++) { V_ED_INSERT_BYTES(v, "\n", 1); V_ED_INSERT_BYTES(v, b->data, b->len - 1); }
+            V_ED_SET_CURSOR(v, len + 1);
+            return;
+        }
+        V_ED_SET_CURSOR(v, pos);
+        for (int i = 0; i < count; i++) V_ED_INSERT_BYTES(v, b->data, b->len);
+        V_ED_SET_CURSOR(v, pos);
+        return;
+    }
+    pos = (after && cur < len && V_ED_GET_CHAR(v, cur) != '\n') ? cur + 1 : cur;
+    V_ED_SET_CURSOR(v, pos);
+    for (int i = 0; i < count; i++) V_ED_INSERT_BYTES(v, b->data, b->len);
+    V_ED_SET_CURSOR(v, pos + b->len * (size_t)count - 1);
+}
+
+// --- REPETIÇÃO E MACROS ---
+// '.' reproduz as teclas da última mudança; q{x} grava teclas no registrador x e
+// @x as reproduz. A reprodução não desenha nada (o host só desenha depois da
+// tecla que a disparou) e, nas macros, todas as edições formam um só grupo de desfazer.
+
+static void v_keys_push(v_keys_t *k, int c) {
+    if (k->len + 3 > k->cap) {
+        k->cap = k->cap ? k->cap * 2 : 64;
+        k->data = (char *)V_REALLOC(k->data, k->cap);
+    }
+    if (c >= 0 && c < 0xFF) { k->data[k->len++] = (char)c; return; }
+    k->data[k->len++] = (char)0xFF;
+    k->data[k->len++] = (char)((c >> 8) & 0xFF);
+    k->data[k->len++] = (char)(c & 0xFF);
+}
+
+static void v_feed(v_state_t *v, const char *keys, size_t n) {
+    for (size_t i = 0; i < n && v->running; i++) {
+        int c = (unsigned char)keys[i];
+        if (c == 0xFF && i + 2 < n) { c = ((unsigned char)keys[i + 1] << 8) | (unsigned char)keys[i + 2]; i += 2; }
+        v_process_key(v, c);
+    }
+}
+
+// '.': um contador novo substitui o contador gravado, que fica fora das teclas
+static void v_repeat(v_state_t *v) {
+    v_keys_t *d = &v->dot;
+    int n = v->count ? v->count : v->dot_count;
+    v->cmd_repeat = 1;
+    if (!d->len || v->replaying >= V_REPLAY_DEPTH) return;
+    v->count = 0;
+    v->replaying++;
+    if (n) { char num[16]; int l = snprintf(num, sizeof(num), "%d", n); v_feed(v, num, (size_t)l); }
+    v_feed(v, d->data, d->len);
+    v->replaying--;
+}
+
+// ESC de um 3ihi: as teclas da inserção valem mais count - 1 vezes
+static void v_insert_repeat(v_state_t *v) {
+    int n = v->ins_count;
+    v->ins_count = 0;
+    if (n < 2 || !v->ins.len || v->replaying >= V_REPLAY_DEPTH) return;
+    v->mode = V_MODE_INSERT;
+    v->replaying++;
+    for (int k = 1; k < n && v->running; k++) {
+        if (v->ins_line) V_ED_INSERT_TEXT(v, "\n");
+        v_feed(v, v->ins.data, v->ins.len);
+    }
+    v->replaying--;
+    v->mode = V_MODE_NORMAL;
+}
+
+static void v_macro_record(v_state_t *v, int name) {
+    if (v_reg_index(name) < 0 || name == '"') return;
+    v->macro_reg = name;
+    v->macro.len = 0;
+}
+
+static void v_macro_stop(v_state_t *v) {
+    v_blob_t *b = v_blob_new(v->macro.len, 0);
+    memcpy(b->data, v->macro.data, v->macro.len);
+    v_reg_store(v, v_reg_index(v->macro_reg), b);
+    v_blob_release(b);
+    v->macro_reg = 0;
+}
+
+// @x, count vezes, em lote
+static void v_macro_run(v_state_t *v, int name) {
+    if (name == '@') name = v->last_macro;
+    int i = name ? v_reg_index(name) : -1;
+    v->cmd_repeat = 1;
+    if (i < 0 || !v->regs[i] || v->replaying >= V_REPLAY_DEPTH) return;
+    v_blob_t *b = v->regs[i];
+    int n = v_count(v);
+    v->last_macro = name;
+    v->count = 0; v->reg = 0;
+    b->refs++; // A macro pode sobrescrever o próprio registrador
+    v_snapshot(v);
+    v->batch++; v->replaying++;
+    for (int k = 0; k < n && v->running; k++) v_feed(v, b->data, b->len);
+    v->batch--; v->replaying--;
+    v->prefix = 0;
+    v_blob_release(b);
+}
+
+// --- BUFFERS ---
+
+void v_buffer_swap(v_state_t *v, v_buffer_t *b) {
+    v_buffer_t t = { v->row_offset, v->row_skip, v->col_offset, { 0 }, v->marks_set, v->syntax, v->hl, v->diff, v->diff_count };
+    memcpy(t.marks, v->marks, sizeof(t.marks));
+    v->row_offset = b->row_offset; v->row_skip = b->row_skip; v->col_offset = b->col_offset;
+    memcpy(v->marks, b->marks, sizeof(v->marks));
+    v->marks_set = b->marks_set;
+    v->syntax = b->syntax;
+    v->hl = b->hl;
+    v->diff = b->diff; v->diff_count = b->diff_count;
+    *b = t;
+    v_layout_reset(v);
+    v->search.count = v->search.scanned = 0;
+    v->want_col = -1;
+    v->mode = V_MODE_NORMAL;
+}
+
+void v_buffer_free(v_buffer_t *b) {
+    V_FREE(b->hl.states); V_FREE(b->hl.text); V_FREE(b->hl.cls); V_FREE(b->diff);
+    memset(b, 0, sizeof(*b));
+}
+
+// --- DIFERENÇAS ---
+
+void v_diff_set(v_state_t *v, const v_diff_mark_t *marks, size_t n) {
+    v->diff = (v_diff_mark_t *)V_REALLOC(v->diff, sizeof(v_diff_mark_t) * (n ? n : 1));
+    if (n) memcpy(v->diff, marks, sizeof(v_diff_mark_t) * n);
+    v->diff_count = n;
+}
+
+// Primeira marca que termina depois de line
+static size_t v_diff_find(v_state_t *v, size_t line) {
+    size_t lo = 0, hi = v->diff_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (v->diff[mid].line + v->diff[mid].count <= line) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+// ]c / [c: início do próximo / anterior trecho diferente
+static void v_diff_jump(v_state_t *v, int forward) {
+    size_t line = V_ED_LINE_OF(v, V_ED_GET_CURSOR(v)), i = v_diff_find(v, line);
+    int inside = i < v->diff_count && v->diff[i].line <= line;
+    if (forward) i += inside;
+    else if (!(inside && v->diff[i].line < line)) { if (i == 0) return; i--; }
+    if (i < v->diff_count) V_ED_SET_CURSOR(v, V_ED_LINE_OFFSET(v, v->diff[i].line));
+}
+
+// Segunda tecla de m ` ' q @ ] [
+static void v_name_key(v_state_t *v, int kind, int c) {
+    if (kind == 'q') v_macro_record(v, c);
+    else if (kind == '@') v_macro_run(v, c);
+    else if (kind == ']' || kind == '[') { if (c == 'c') V_TIMES(v) v_diff_jump(v, kind == ']'); }
+    else v_mark_key(v, kind, c);
+}
+
+// Ponto único de notificação de edições para os caches da interface
+void v_text_changed(v_state_t *v, size_t offset, size_t removed, size_t inserted,
+                    size_t line, size_t lines_removed, size_t lines_inserted) {
+    v_layout_lines_changed(v, line, lines_removed + 1, lines_inserted + 1);
+    v_hl_lines_changed(v, line, lines_removed + 1, lines_inserted + 1);
+    v_search_changed(v, offset, removed, inserted);
+    v_marks_changed(v, offset, removed, inserted);
+    v->diff_count = 0;
+    v->cmd_changed = 1;
+}
+
+int v_background(v_state_t *v) {
+    int r = 0;
+    if (v->syntax) {
+        size_t n = V_ED_LINE_COUNT(v);
+        if (v->hl.valid < n) v_hl_advance(v, v->hl.valid + V_HL_SLICE);
+        if (v->hl.approx && v->hl.valid >= (size_t)v->row_offset) { v->hl.approx = 0; r |= V_BG_REDRAW; }
+        if (v->hl.valid < n) r |= V_BG_MORE;
+    }
+    if (v->search.qlen) {
+        // Completa a contagem de ocorrências; a barra de status muda ao terminar
+        size_t len = V_ED_GET_LENGTH(v);
+        if (v->search.scanned < len) {
+            v_search_scan(v, v->search.scanned + V_SEARCH_SLICE);
+            r |= v->search.scanned < len ? V_BG_MORE : V_BG_REDRAW;
+        }
+    }
+    return r;
+}
+
+void v_free(v_state_t *v) {
+    V_FREE(v->hl.states); V_FREE(v->hl.text); V_FREE(v->hl.cls);
+    memset(&v->hl, 0, sizeof(v->hl));
+    V_FREE(v->search.pos);
+    memset(&v->search, 0, sizeof(v->search));
+    for (int i = 0; i < V_REGISTERS; i++) { v_blob_release(v->regs[i]); v->regs[i] = NULL; }
+    V_FREE(v->cmd.data); V_FREE(v->dot.data); V_FREE(v->macro.data); V_FREE(v->ins.data);
+    V_FREE(v->diff); v->diff = NULL; v->diff_count = 0;
+    memset(&v->cmd, 0, sizeof(v_keys_t)); memset(&v->dot, 0, sizeof(v_keys_t)); memset(&v->macro, 0, sizeof(v_keys_t));
+    memset(&v->ins, 0, sizeof(v_keys_t));
+}
 
 // --- RENDERIZAÇÃO ---
 
+// Mantém o cursor visível. Com wrap, o topo da tela pode começar no meio de uma
+// linha (row_offset + row_skip), e só as linhas entre o topo e o cursor são medidas.
 static void v_scroll(v_state_t *v) {
-    size_t r, c;
-    V_ED_GET_ROW_COL(v, V_ED_GET_CURSOR(v), &r, &c);
-    if ((int)r < v->row_offset) v->row_offset = (int)r;
-    if ((int)r >= v->row_offset + v->screen_rows - 1) v->row_offset = (int)r - (v->screen_rows - 2);
+    size_t cur = V_ED_GET_CURSOR(v);
+    size_t cl = V_ED_LINE_OF(v, cur);
+    size_t cc = v_display_col(v, cl, cur);
+    size_t cols = (size_t)v_text_cols(v);
+    size_t text_rows = v->screen_rows > 1 ? (size_t)v->screen_rows - 1 : 1;
+    // Um corte grande pode deixar o topo da tela depois do fim do texto
+    if ((size_t)v->row_offset > cl) { v->row_offset = (int)cl; v->row_skip = 0; }
+
+    if (!v->wrap) {
+        v->row_skip = 0;
+        if ((int)cl < v->row_offset) v->row_offset = (int)cl;
+        if (cl >= (size_t)v->row_offset + text_rows) v->row_offset = (int)(cl - text_rows + 1);
+        if (cc < (size_t)v->col_offset) v->col_offset = (int)cc;
+        if (cc >= (size_t)v->col_offset + cols) v->col_offset = (int)(cc - cols + 1);
+        v->cursor_y = (int)(cl - v->row_offset);
+        v->cursor_x = (int)(cc - v->col_offset);
+        return;
+    }
+
+    v->col_offset = 0;
+    size_t cr = cc / cols, rows = v_line_rows(v, cl);
+    if (cr >= rows) cr = rows - 1;
+    if (v->row_skip >= (int)v_line_rows(v, v->row_offset)) v->row_skip = (int)v_line_rows(v, v->row_offset) - 1;
+
+    if (cl < (size_t)v->row_offset || (cl == (size_t)v->row_offset && cr < (size_t)v->row_skip)) {
+        v->row_offset = (int)cl; v->row_skip = (int)cr;
+    } else {
+        size_t sum = 0;
+        for (size_t l = v->row_offset; l < cl && sum <= text_rows + v->row_skip; l++) sum += v_line_rows(v, l);
+        if (sum + cr - v->row_skip >= text_rows) {
+            // Coloca o cursor na última linha da tela, subindo linha a linha
+            size_t need = text_rows - 1, l = cl, sub = cr;
+            while (need > 0) {
+                if (sub >= need) { sub -= need; need = 0; }
+                else if (l == 0) { sub = 0; need = 0; }
+                else { need -= sub + 1; l--; sub = v_line_rows(v, l) - 1; }
+            }
+            v->row_offset = (int)l; v->row_skip = (int)sub;
+        }
+    }
+
+    size_t y = cr;
+    for (size_t l = v->row_offset; l < cl; l++) y += v_line_rows(v, l);
+    v->cursor_y = (int)(y - v->row_skip);
+    v->cursor_x = (int)(cc - cr * cols);
 }
 
 void v_render(v_state_t *v) {
@@ -160,50 +1063,119 @@ void v_render(v_state_t *v) {
     V_CLR_TEXT();
     V_TERM_CLEAR();
 
-    int ln_width = 4;
-    size_t len = V_ED_GET_LENGTH(v);
     size_t cur_pos = V_ED_GET_CURSOR(v);
     size_t sel_start = (v->visual_anchor < cur_pos) ? v->visual_anchor : cur_pos;
     size_t sel_end = (v->visual_anchor < cur_pos) ? cur_pos : v->visual_anchor;
+    size_t cols = (size_t)v_text_cols(v);
+    int text_rows = v->screen_rows - 1;
+
+    // Só as linhas visíveis são percorridas: o índice de linhas dá o início de cada uma
+    size_t n_lines = V_ED_LINE_COUNT(v);
+    size_t line = (size_t)v->row_offset, skip = (size_t)v->row_skip;
+    size_t qlen = v->search.qlen;
+    int show_matches = qlen > 0 && !v->search.hidden;
+
+    // Estado do lexer na entrada do viewport. Longe demais do trecho já analisado,
+    // usa o último estado conhecido e deixa o job de fundo corrigir depois.
+    int hl_state = 0;
+    if (v->syntax) {
+        v_highlight_t *hl = &v->hl;
+        if (line <= hl->valid + V_HL_SYNC_LINES) v_hl_advance(v, line + (size_t)text_rows);
+        if (line <= hl->valid) hl_state = line ? hl->states[line - 1] : 0;
+        else { hl_state = (line - 1 < hl->known) ? hl->states[line - 1] : 0; hl->approx = 1; }
+    }
 
-    int r_ui = 0, c_ui = 0;
-    int in_sel = 0;
+    int y = 0;
+    size_t dm = v_diff_find(v, line); // Próxima marca do :diff
+    while (y < text_rows && line < n_lines) {
+        size_t start = V_ED_LINE_OFFSET(v, line);
+        size_t end = v_line_end(v, line);
+        size_t rows = v_line_rows(v, line);
+        size_t hl_len = 0;
+        if (v->syntax) hl_state = v_hl_lex(v, line, hl_state, 1, &hl_len);
+        int cur_cls = 0;
+        size_t match = V_NOT_FOUND; // Ocorrência da busca em curso ou a próxima da linha
 
-    for (size_t i = 0; i <= len; i++) {
-        int visible = (r_ui >= v->row_offset && r_ui < v->row_offset + v->screen_rows - 1);
-        if (visible) {
-            if (c_ui == 0) {
-                V_TERM_GOTOXY(1, r_ui - v->row_offset + 1);
-                V_CLR_TEXT(); V_CLR_LINENUM(); printf("%3d ", r_ui + 1);
-                in_sel = 0; V_CLR_TEXT();
+        // Pula os caracteres inteiros antes da primeira coluna visível
+        // (linhas de wrap acima do topo ou rolagem horizontal)
+        size_t first_col = v->wrap ? skip * cols : (size_t)v->col_offset;
+        size_t i = start, col = 0;
+        if (first_col > 0) { i = v_pos_at_col(v, line, first_col); col = v_display_col(v, line, i); }
+        if (show_matches) match = v_search_next_in(v, i >= qlen - 1 && i - (qlen - 1) > start ? i - (qlen - 1) : start, end);
+
+        for (size_t r = skip; r < rows && y < text_rows; r++, y++) {
+            V_TERM_GOTOXY(1, y + 1);
+            V_CLR_TEXT(); V_CLR_LINENUM();
+            if (r == 0) {
+                printf("%3zu", line + 1);
+                while (dm < v->diff_count && v->diff[dm].line + v->diff[dm].count <= line) dm++;
+                if (dm < v->diff_count && v->diff[dm].line <= line) { V_CLR_DIFF(v->diff[dm].kind); putchar(v->diff[dm].kind); }
+                else putchar(' ');
+            } else printf("%*s", V_LN_WIDTH, "");
+            V_CLR_TEXT(); cur_cls = 0;
+            size_t row_start = v->wrap ? r * cols : first_col, limit = row_start + cols;
+            int bg = 0, shown = 0;
+            while (i <= end && col < limit) {
+                int s = (v->mode == V_MODE_VISUAL && i >= sel_start && i <= sel_end);
+                while (match != V_NOT_FOUND && i >= match + qlen) match = v_search_next_in(v, match + 1, end);
+                int b = s ? 2 : (match != V_NOT_FOUND && i >= match && i < end) ? 1 : 0;
+                if (b != bg) {
+                    V_CLR_TEXT(); cur_cls = 0;
+                    if (b == 2) V_CLR_SELECTION(); else if (b == 1) V_CLR_MATCH();
+                    bg = b;
+                }
+                if (i == end) { if (s) putchar(' '); break; }
+                if (v->syntax) {
+                    int k = (i - start < hl_len) ? v->hl.cls[i - start] : 0;
+                    if (k != cur_cls) { V_CLR_SYNTAX(k); cur_cls = k; }
+                }
+                unsigned char ch = (unsigned char)V_ED_GET_CHAR(v, i);
+                size_t w = v_char_width(v, ch, col);
+                if (w == 0) { if (shown) putchar(ch); }
+                else if (ch == '\t' || ch < 0x20 || ch == 0x7f) {
+                    // Um caractere largo pode ser cortado pela borda da linha de tela
+                    for (size_t k = 0; k < w; k++) {
+                        if (col + k < row_start || col + k >= limit) continue;
+                        putchar(ch == '\t' ? ' ' : k == 0 ? '^' : (ch == 0x7f ? '?' : ch + '@'));
+                    }
+                    shown = 1;
+                } else { putchar(ch); shown = 1; }
+                if (col + w > limit) break; // continua na próxima linha de tela
+                col += w; i++;
             }
-            int s = (v->mode == V_MODE_VISUAL && i >= sel_start && i <= sel_end);
-            if (s && !in_sel) { V_CLR_SELECTION(); in_sel = 1; }
-            else if (!s && in_sel) { V_CLR_TEXT(); in_sel = 0; }
-            V_TERM_GOTOXY(c_ui + 1 + ln_width, r_ui - v->row_offset + 1);
-            if (i == len) { if (s) putchar(' '); }
-            else { char c = V_ED_GET_CHAR(v, i); if (c == '\n') putchar(' '); else putchar(c); }
         }
-        if (i < len) { if (V_ED_GET_CHAR(v, i) == '\n') { r_ui++; c_ui = 0; } else c_ui++; } else break;
+        line++; skip = 0;
     }
 
     V_CLR_STATUS();
     V_TERM_GOTOXY(1, v->screen_rows);
     size_t r, c; V_ED_GET_ROW_COL(v, cur_pos, &r, &c);
     const char *ms = (v->mode == V_MODE_NORMAL) ? "-- NORMAL --" : (v->mode == V_MODE_INSERT) ? "-- INSERT --" : (v->mode == V_MODE_SEARCH) ? "-- SEARCH --" : (v->mode == V_MODE_VISUAL) ? "-- VISUAL --" : "-- COMMAND --";
-    char st[256]; snprintf(st, 256, " %s | L: %zu, C: %zu ", ms, r + 1, c + 1);
+    size_t vc = v_display_col(v, r, cur_pos);
+    char st[256];
+    int sl;
+    if (v->message[0]) sl = snprintf(st, 256, " %s ", v->message);
+    else if (vc == c) sl = snprintf(st, 256, " %s | L: %zu, C: %zu ", ms, r + 1, c + 1);
+    else sl = snprintf(st, 256, " %s | L: %zu, C: %zu-%zu ", ms, r + 1, c + 1, vc + 1);
+    // "i de k" para a ocorrência sob o cursor; k ganha um + enquanto a contagem não termina
+    v_search_t *sr = &v->search;
+    if (qlen > 0 && cur_pos < sr->scanned && !v->message[0]) {
+        size_t k = v_search_lower(sr, cur_pos);
+        if (k < sr->count && sr->pos[k] == cur_pos)
+            snprintf(st + sl, 256 - (size_t)sl, "| [%zu/%zu%s] ", k + 1, sr->count, sr->scanned < V_ED_GET_LENGTH(v) ? "+" : "");
+    }
     printf("%s", st);
     for (int i = (int)strlen(st); i < v->screen_cols; i++) putchar(' ');
     V_CLR_RESET();
 
     if (v->mode == V_MODE_COMMAND || v->mode == V_MODE_SEARCH) {
         V_TERM_GOTOXY(1, v->screen_rows);
-        printf("%c%s", (v->mode == V_MODE_COMMAND ? ':' : '/'), (v->mode == V_MODE_COMMAND ? v->command_buffer : v->search_buffer));
+        printf("%c%s", (v->mode == V_MODE_COMMAND ? ':' : v->search.forward ? '/' : '?'), (v->mode == V_MODE_COMMAND ? v->command_buffer : v->search_buffer));
     } else {
-        V_TERM_GOTOXY((int)c + 1 + ln_width, (int)r - v->row_offset + 1);
+        V_TERM_GOTOXY(v->cursor_x + 1 + V_LN_WIDTH, v->cursor_y + 1);
     }
     V_TERM_CURSOR_SHOW(1);
-    fflush(stdout);
+    V_TERM_FLUSH();
 }
 
 // --- LÓGICA VI ---
@@ -218,30 +1190,47 @@ static void v_word_next(v_state_t *v) {
 
 // --- KEYMAPS ---
 #define V_NORMAL_KEYMAP(V, v, c) \
-    V('i', { (v)->mode = V_MODE_INSERT; }) \
-    V('a', { V_ED_SET_CURSOR(v, V_ED_GET_CURSOR(v) + 1); (v)->mode = V_MODE_INSERT; }) \
+    V('i', { v_snapshot(v); (v)->mode = V_MODE_INSERT; }) \
+    V('a', { v_snapshot(v); V_ED_SET_CURSOR(v, V_ED_GET_CURSOR(v) + 1); (v)->mode = V_MODE_INSERT; }) \
     V('v', { (v)->mode = V_MODE_VISUAL; (v)->visual_anchor = V_ED_GET_CURSOR(v); }) \
-    V('o', { V_ED_SAVE_SNAPSHOT(v); V_ED_SET_CURSOR(v, V_ED_FIND_LINE_END(v, V_ED_GET_CURSOR(v))); V_ED_INSERT_TEXT(v, "\n"); (v)->mode = V_MODE_INSERT; }) \
-    V('O', { V_ED_SAVE_SNAPSHOT(v); size_t s = V_ED_FIND_LINE_START(v, V_ED_GET_CURSOR(v)); V_ED_SET_CURSOR(v, s); V_ED_INSERT_TEXT(v, "\n"); V_ED_SET_CURSOR(v, s); (v)->mode = V_MODE_INSERT; }) \
-    V(':', { (v)->mode = V_MODE_COMMAND; (v)->command_buffer[0] = '\0'; }) \
-    V('/', { (v)->mode = V_MODE_SEARCH; (v)->search_buffer[0] = '\0'; }) \
-    V('h', { V_ED_SET_CURSOR(v, V_ED_GET_CURSOR(v) > 0 ? V_ED_GET_CURSOR(v) - 1 : 0); }) \
-    V('l', { V_ED_SET_CURSOR(v, V_ED_GET_CURSOR(v) + 1); }) \
-    V('j', { V_ACTION_MOVE_LINE(v, 1); }) \
-    V('k', { V_ACTION_MOVE_LINE(v, -1); }) \
-    V('u', { V_ED_UNDO(v); }) \
-    V('x', { V_ED_SAVE_SNAPSHOT(v); V_ED_DELETE_RANGE(v, V_ED_GET_CURSOR(v), V_ED_GET_CURSOR(v) + 1); }) \
+    V('o', { v_snapshot(v); V_ED_SET_CURSOR(v, V_ED_FIND_LINE_END(v, V_ED_GET_CURSOR(v))); V_ED_INSERT_TEXT(v, "\n"); (v)->mode = V_MODE_INSERT; }) \
+    V('O', { v_snapshot(v); size_t s = V_ED_FIND_LINE_START(v, V_ED_GET_CURSOR(v)); V_ED_SET_CURSOR(v, s); V_ED_INSERT_TEXT(v, "\n"); V_ED_SET_CURSOR(v, s); (v)->mode = V_MODE_INSERT; }) \
+    V(':', { (v)->mode = V_MODE_COMMAND; (v)->command_buffer[0] = '\0'; (v)->cmd_repeat = 1; }) \
+    V('/', { (v)->mode = V_MODE_SEARCH; (v)->search_buffer[0] = '\0'; (v)->search.forward = 1; (v)->search.origin = V_ED_GET_CURSOR(v); }) \
+    V('?', { (v)->mode = V_MODE_SEARCH; (v)->search_buffer[0] = '\0'; (v)->search.forward = 0; (v)->search.origin = V_ED_GET_CURSOR(v); }) \
+    V('n', { V_TIMES(v) v_search_jump(v, 1); }) \
+    V('N', { V_TIMES(v) v_search_jump(v, 0); }) \
+    V('m', { (v)->pending_name = 'm'; (v)->prefix = 1; return; }) \
+    V('`', { (v)->pending_name = '`'; (v)->prefix = 1; return; }) \
+    V('\'', { (v)->pending_name = '\''; (v)->prefix = 1; return; }) \
+    V('q', { if ((v)->macro_reg) v_macro_stop(v); else { (v)->pending_name = 'q'; (v)->prefix = 1; } return; }) \
+    V('@', { (v)->pending_name = '@'; (v)->prefix = 1; return; }) \
+    V(']', { (v)->pending_name = ']'; (v)->prefix = 1; return; }) \
+    V('[', { (v)->pending_name = '['; (v)->prefix = 1; return; }) \
+    V('.', { v_repeat(v); }) \
+    V('h', { V_TIMES(v) V_ED_SET_CURSOR(v, V_ED_GET_CURSOR(v) > 0 ? V_ED_GET_CURSOR(v) - 1 : 0); }) \
+    V('l', { V_TIMES(v) V_ED_SET_CURSOR(v, V_ED_GET_CURSOR(v) + 1); }) \
+    V('j', { V_TIMES(v) V_ACTION_MOVE_LINE(v, 1); }) \
+    V('k', { V_TIMES(v) V_ACTION_MOVE_LINE(v, -1); }) \
+    V('u', { V_TIMES(v) V_ED_UNDO(v); (v)->cmd_repeat = 1; }) \
+    V('x', { \
+        size_t p = V_ED_GET_CURSOR(v); size_t le = V_ED_FIND_LINE_END(v, p); \
+        size_t e = (size_t)v_count(v) < le - p ? p + (size_t)v_count(v) : le; \
+        if (e > p) { v_yank(v, p, e, 0, 1); v_snapshot(v); V_ED_DELETE_RANGE(v, p, e); } \
+    }) \
     V('d', { (v)->pending_d = 1; return; }) \
     V('y', { (v)->pending_y = 1; return; }) \
     V('g', { (v)->pending_g = 1; return; }) \
-    V('w', { v_word_next(v); }) \
-    V('p', { V_ED_PASTE(v); }) \
+    V('w', { V_TIMES(v) v_word_next(v); }) \
+    V('p', { v_put(v, 1, v_count(v)); }) \
+    V('P', { v_put(v, 0, v_count(v)); }) \
+    V('"', { (v)->reg = '"'; (v)->prefix = 1; }) \
     V('0', { V_ED_SET_CURSOR(v, V_ED_FIND_LINE_START(v, V_ED_GET_CURSOR(v))); }) \
     V('$', { V_ED_SET_CURSOR(v, V_ED_FIND_LINE_END(v, V_ED_GET_CURSOR(v))); }) \
-    V(V_KEY_UP,    { V_ACTION_MOVE_LINE(v, -1); }) \
-    V(V_KEY_DOWN,  { V_ACTION_MOVE_LINE(v, 1); }) \
-    V(V_KEY_LEFT,  { V_ED_SET_CURSOR(v, V_ED_GET_CURSOR(v) > 0 ? V_ED_GET_CURSOR(v) - 1 : 0); }) \
-    V(V_KEY_RIGHT, { V_ED_SET_CURSOR(v, V_ED_GET_CURSOR(v) + 1); }) \
+    V(V_KEY_UP,    { V_TIMES(v) V_ACTION_MOVE_LINE(v, -1); }) \
+    V(V_KEY_DOWN,  { V_TIMES(v) V_ACTION_MOVE_LINE(v, 1); }) \
+    V(V_KEY_LEFT,  { V_TIMES(v) V_ED_SET_CURSOR(v, V_ED_GET_CURSOR(v) > 0 ? V_ED_GET_CURSOR(v) - 1 : 0); }) \
+    V(V_KEY_RIGHT, { V_TIMES(v) V_ED_SET_CURSOR(v, V_ED_GET_CURSOR(v) + 1); }) \
     V(V_KEY_CTRL_O, { V_ACTION_CUSTOM(v, V_KEY_CTRL_O); })
 
 #define V_VISUAL_KEYMAP(V, v, c) \
@@ -254,31 +1243,54 @@ static void v_word_next(v_state_t *v) {
         size_t cp = V_ED_GET_CURSOR(v); \
         size_t s = (v->visual_anchor < cp) ? v->visual_anchor : cp; \
         size_t e = (v->visual_anchor < cp) ? cp : v->visual_anchor; \
-        V_ED_SAVE_SNAPSHOT(v); V_ED_DELETE_RANGE(v, s, e + 1); (v)->mode = V_MODE_NORMAL; \
+        v_yank(v, s, e + 1, 0, 1); v_snapshot(v); V_ED_DELETE_RANGE(v, s, e + 1); (v)->mode = V_MODE_NORMAL; \
     }) \
     V('y', { \
         size_t cp = V_ED_GET_CURSOR(v); \
         size_t s = (v->visual_anchor < cp) ? v->visual_anchor : cp; \
         size_t e = (v->visual_anchor < cp) ? cp : v->visual_anchor; \
-        V_ED_YANK(v, s, e + 1); (v)->mode = V_MODE_NORMAL; \
-    })
+        v_yank(v, s, e + 1, 0, 0); (v)->mode = V_MODE_NORMAL; \
+    }) \
+    V('"', { (v)->reg = '"'; (v)->prefix = 1; }) \
+    V(':', { (v)->mode = V_MODE_COMMAND; strcpy((v)->command_buffer, "'<,'>"); (v)->cmd_repeat = 1; })
+
+// Comandos ':' tratados pelo próprio v_clone. Retorna 1 se reconheceu o comando.
+static int v_builtin_command(v_state_t *v, const char *cmd) {
+    if (strcmp(cmd, "set wrap") == 0) { v->wrap = 1; return 1; }
+    if (strcmp(cmd, "set nowrap") == 0) { v->wrap = 0; v->row_skip = 0; return 1; }
+    if (strcmp(cmd, "syntax on") == 0) { v->syntax = 1; v_hl_reset(v); return 1; }
+    if (strcmp(cmd, "syntax off") == 0) { v->syntax = 0; return 1; }
+    if (strcmp(cmd, "noh") == 0) { v->search.hidden = 1; return 1; }
+    if (strncmp(cmd, "set ts=", 7) == 0 && atoi(cmd + 7) > 0) { v->tabstop = atoi(cmd + 7); v_layout_reset(v); return 1; }
+    return 0;
+}
 
 // --- PROCESSADORES ---
 #ifndef V_PROCESS_NORMAL
 #define V_PROCESS_NORMAL(v, c) \
     do { \
+        if ((v)->pending_name) { int k = (v)->pending_name; (v)->pending_name = 0; v_name_key(v, k, c); return; } \
+        if ((c >= '1' && c <= '9') || (c == '0' && (v)->count)) { \
+            if ((v)->count < 100000000) (v)->count = (v)->count * 10 + (c - '0'); \
+            (v)->prefix = 1; return; \
+        } \
         if ((v)->pending_d && c == 'd') { \
-            size_t p = V_ED_GET_CURSOR(v); V_ED_SAVE_SNAPSHOT(v); \
-            V_ED_DELETE_RANGE(v, V_ED_FIND_LINE_START(v, p), V_ED_FIND_LINE_END(v, p) + 1); \
+            size_t l = V_ED_LINE_OF(v, V_ED_GET_CURSOR(v)); \
+            size_t ls = V_ED_LINE_OFFSET(v, l), le = V_ED_LINE_OFFSET(v, l + (size_t)v_count(v)); \
+            v_yank(v, ls, le, 1, 1); v_snapshot(v); V_ED_DELETE_RANGE(v, ls, le); \
             (v)->pending_d = 0; if ((v)->insert_return) (v)->mode = V_MODE_INSERT; return; \
         } \
         if ((v)->pending_y && c == 'y') { \
-            size_t p = V_ED_GET_CURSOR(v); \
-            V_ED_YANK(v, V_ED_FIND_LINE_START(v, p), V_ED_FIND_LINE_END(v, p) + 1); \
+            size_t l = V_ED_LINE_OF(v, V_ED_GET_CURSOR(v)); \
+            v_yank(v, V_ED_LINE_OFFSET(v, l), V_ED_LINE_OFFSET(v, l + (size_t)v_count(v)), 1, 0); \
             (v)->pending_y = 0; if ((v)->insert_return) (v)->mode = V_MODE_INSERT; return; \
         } \
-        if ((v)->pending_g && c == 'g') { V_ED_SET_CURSOR(v, 0); (v)->pending_g = 0; if ((v)->insert_return) (v)->mode = V_MODE_INSERT; return; } \
+        if ((v)->pending_g && c == 'g') { \
+            V_ED_SET_CURSOR(v, (v)->count ? V_ED_LINE_OFFSET(v, (size_t)(v)->count - 1) : 0); \
+            (v)->pending_g = 0; if ((v)->insert_return) (v)->mode = V_MODE_INSERT; return; \
+        } \
         int pt = (c == 'd' || c == 'y' || c == 'g'); \
+        if (pt) (v)->prefix = 1; \
         if (!pt) { (v)->pending_d = (v)->pending_g = (v)->pending_y = 0; } \
         switch (c) { \
             V_CUSTOM_NORMAL(V_EXPAND, v, c) \
@@ -300,7 +1312,7 @@ static void v_word_next(v_state_t *v) {
         V_CUSTOM_INSERT(V_EXPAND, v, c) \
         V(V_KEY_CTRL_O, { (v)->mode = V_MODE_NORMAL; (v)->insert_return = 1; }) \
         V(V_KEY_BACKSPACE, { size_t p = V_ED_GET_CURSOR(v); if (p > 0) V_ED_DELETE_RANGE(v, p-1, p); }) \
-        V(V_KEY_ENTER,     { V_ED_SAVE_SNAPSHOT(v); V_ED_INSERT_TEXT(v, "\n"); }) \
+        V(V_KEY_ENTER,     { v_snapshot(v); V_ED_INSERT_TEXT(v, "\n"); }) \
         default: if (c < 1000) { char s[2] = {(char)c, 0}; V_ED_INSERT_TEXT(v, s); } break; \
     }
 #endif
@@ -311,8 +1323,7 @@ static void v_word_next(v_state_t *v) {
         V_CUSTOM_CMD(V_EXPAND, v, c) \
         V(V_KEY_ENTER, { \
             char *b = ((v)->mode == V_MODE_COMMAND) ? (v)->command_buffer : (v)->search_buffer; \
-            if ((v)->mode == V_MODE_COMMAND) V_ACTION_COMMAND(v, b); \
-            else V_ED_SEARCH(v, b, 1); \
+            if ((v)->mode == V_MODE_COMMAND) { if (!v_builtin_command(v, b)) V_ACTION_COMMAND(v, b); } \
             (v)->mode = V_MODE_NORMAL; \
         }) \
         V(V_KEY_BACKSPACE, { \
@@ -327,18 +1338,161 @@ static void v_word_next(v_state_t *v) {
     }
 #endif
 
-void v_init(v_state_t *v) { memset(v, 0, sizeof(v_state_t)); v->mode = V_MODE_NORMAL; v->running = 1; }
+void v_init(v_state_t *v) { memset(v, 0, sizeof(v_state_t)); v->mode = V_MODE_NORMAL; v->running = 1; v->wrap = 1; v->tabstop = 8; v->want_col = -1; }
 
-void v_process_key(v_state_t *v, int c) {
+static void v_dispatch_key(v_state_t *v, int c) {
     if (c == V_KEY_ESC) {
+        // Desistir da busca volta o cursor para onde ela começou
+        if (v->mode == V_MODE_SEARCH) { v_search_set(v, ""); V_ED_SET_CURSOR(v, v->search.origin); }
         (v)->mode = V_MODE_NORMAL; (v)->command_buffer[0] = (v)->search_buffer[0] = '\0';
-        (v)->pending_d = (v)->pending_g = (v)->pending_y = (v)->insert_return = 0; return;
+        (v)->pending_d = (v)->pending_g = (v)->pending_y = (v)->pending_name = (v)->reg = (v)->count = (v)->insert_return = 0; return;
     }
     switch (c) { V_CUSTOM_GLOBAL(V_EXPAND, v, c) }
+    if (v->reg == '"' && (v->mode == V_MODE_NORMAL || v->mode == V_MODE_VISUAL)) {
+        v->reg = (c != '"' && v_reg_index(c) >= 0) ? c : 0;
+        v->prefix = 1;
+        return;
+    }
     if (v->mode == V_MODE_NORMAL) { V_PROCESS_NORMAL(v, c); }
     else if (v->mode == V_MODE_VISUAL) { V_PROCESS_VISUAL(v, c); }
     else if (v->mode == V_MODE_INSERT) { V_PROCESS_INSERT(v, c); }
     else if (v->mode == V_MODE_COMMAND || v->mode == V_MODE_SEARCH) { V_PROCESS_COMMAND(v, c); }
 }
 
+// --- SESSÃO ---
+// Registradores que compartilham um bloco apontam para o primeiro que o usa,
+// para que a restauração volte a compartilhar em vez de duplicar.
+
+static void v_sess_put(char **p, size_t *n, const void *src, size_t len) {
+    if (*p) { memcpy(*p, src, len); *p += len; }
+    *n += len;
+}
+
+static int v_sess_get(const char **p, const char *end, void *dst, size_t len) {
+    if ((size_t)(end - *p) < len) return 0;
+    memcpy(dst, *p, len);
+    *p += len;
+    return 1;
+}
+
+size_t v_session_save(const v_state_t *v, char *out) {
+    size_t n = 0;
+    int view[3] = { v->row_offset, v->row_skip, v->col_offset };
+    v_sess_put(&out, &n, view, sizeof(view));
+    v_sess_put(&out, &n, &v->marks_set, sizeof(v->marks_set));
+    v_sess_put(&out, &n, v->marks, sizeof(v->marks));
+    for (int i = 0; i < V_REGISTERS; i++) {
+        v_blob_t *b = v->regs[i];
+        int tag = b ? -2 : -1; // -1 vazio, -2 bloco novo, j >= 0 o mesmo do registrador j
+        for (int j = 0; b && j < i; j++) if (v->regs[j] == b) { tag = j; break; }
+        v_sess_put(&out, &n, &tag, sizeof(tag));
+        if (tag != -2) continue;
+        v_sess_put(&out, &n, &b->linewise, sizeof(b->linewise));
+        v_sess_put(&out, &n, &b->len, sizeof(b->len));
+        v_sess_put(&out, &n, b->data, b->len);
+    }
+    v_sess_put(&out, &n, &v->dot.len, sizeof(v->dot.len));
+    v_sess_put(&out, &n, v->dot.data, v->dot.len);
+    v_sess_put(&out, &n, &v->last_macro, sizeof(v->last_macro));
+    v_sess_put(&out, &n, &v->dot_count, sizeof(v->dot_count));
+    return n;
+}
+
+int v_session_load(v_state_t *v, const char *data, size_t len) {
+    const char *p = data, *end = data + len;
+    int view[3];
+    if (!v_sess_get(&p, end, view, sizeof(view)) || !v_sess_get(&p, end, &v->marks_set, sizeof(v->marks_set)) ||
+        !v_sess_get(&p, end, v->marks, sizeof(v->marks))) return 0;
+    v->row_offset = view[0]; v->row_skip = view[1]; v->col_offset = view[2];
+    for (int i = 0; i < V_REGISTERS; i++) {
+        int tag, linewise;
+        size_t n;
+        if (!v_sess_get(&p, end, &tag, sizeof(tag))) return 0;
+        if (tag >= 0 && tag < i && v->regs[tag]) { v_reg_store(v, i, v->regs[tag]); continue; }
+        if (tag != -2) continue;
+        if (!v_sess_get(&p, end, &linewise, sizeof(linewise)) || !v_sess_get(&p, end, &n, sizeof(n)) ||
+            (size_t)(end - p) < n) return 0;
+        v_blob_t *b = v_blob_new(n, linewise);
+        memcpy(b->data, p, n);
+        p += n;
+        v_reg_store(v, i, b);
+        v_blob_release(b);
+    }
+    size_t n;
+    if (!v_sess_get(&p, end, &n, sizeof(n)) || (size_t)(end - p) < n) return 0;
+    // As teclas já estão codificadas: copia os bytes
+    if (n > v->dot.cap) { v->dot.cap = n; v->dot.data = (char *)V_REALLOC(v->dot.data, n); }
+    if (n) memcpy(v->dot.data, p, n);
+    v->dot.len = n;
+    p += n;
+    if (!v_sess_get(&p, end, &v->last_macro, sizeof(v->last_macro))) return 0;
+    // Imagens antigas não têm o contador do '.' (que ia junto das teclas)
+    if (!v_sess_get(&p, end, &v->dot_count, sizeof(v->dot_count))) v->dot_count = 0;
+    return 1;
+}
+
+void v_message(v_state_t *v, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(v->message, sizeof(v->message), fmt, ap);
+    va_end(ap);
+}
+
+void v_process_key(v_state_t *v, int c) {
+    size_t cur0 = V_ED_GET_CURSOR(v);
+    v->keep_col = 0;
+    if (!v->replaying) v->message[0] = 0;
+    int searching = v->mode == V_MODE_SEARCH, visual = v->mode == V_MODE_VISUAL;
+    int inserting = v->mode == V_MODE_INSERT, returning = v->insert_return, count0 = v->count;
+    int recording = v->macro_reg && !v->replaying;
+    // Um comando começa no modo normal, depois de outro ter terminado
+    if (!v->replaying) {
+        if (v->mode == V_MODE_NORMAL && !v->prefix) { v->cmd.len = v->cmd_count = 0; v->cmd_changed = v->cmd_repeat = 0; }
+        v_keys_push(&v->cmd, c);
+    }
+    if (inserting && c != V_KEY_ESC && v->ins_count > 1) v_keys_push(&v->ins, c);
+    v->prefix = 0;
+    v_dispatch_key(v, c);
+    if (recording && v->macro_reg) v_keys_push(&v->macro, c);
+    // Os dígitos do contador ficam fora das teclas do '.', que guarda o contador à parte
+    if (v->count > count0 && !v->replaying) v->cmd.len--;
+    if (!inserting && v->mode == V_MODE_INSERT && !returning) {
+        v->ins.len = 0;
+        v->ins_count = v_count(v);
+        v->ins_line = c == 'o' || c == 'O';
+    }
+    if (inserting && c == V_KEY_ESC) v_insert_repeat(v);
+    if (!v->prefix) {
+        // Contador e registrador valem só para o próximo comando
+        if (v->count) v->cmd_count = v->count;
+        v->count = 0; v->reg = 0;
+        if (!v->replaying && v->mode == V_MODE_NORMAL && v->cmd_changed && !v->cmd_repeat) {
+            v_keys_t t = v->dot; v->dot = v->cmd; v->cmd = t;
+            v->dot_count = v->cmd_count;
+        }
+    }
+    if (searching && c != V_KEY_ESC && c != V_KEY_ENTER) v_search_update(v);
+    if (visual && v->mode != V_MODE_VISUAL) {
+        size_t a = v->visual_anchor;
+        v_mark_set(v, 26, a < cur0 ? a : cur0);
+        v_mark_set(v, 27, a < cur0 ? cur0 : a);
+    }
+    if (!v->keep_col) v->want_col = -1;
+}
+
+void v_paste(v_state_t *v, const char *text, size_t len) {
+    if (len == 0) return;
+    if (v->mode == V_MODE_COMMAND || v->mode == V_MODE_SEARCH) {
+        char *b = (v->mode == V_MODE_COMMAND) ? v->command_buffer : v->search_buffer;
+        size_t l = strlen(b);
+        for (size_t i = 0; i < len && text[i] != '\n' && l < sizeof(v->command_buffer) - 1; i++) b[l++] = text[i];
+        b[l] = '\0';
+        if (v->mode == V_MODE_SEARCH) v_search_update(v);
+        return;
+    }
+    if (v->mode == V_MODE_VISUAL) v->mode = V_MODE_NORMAL;
+    v_snapshot(v);
+    V_ED_INSERT_BYTES(v, text, len);
+}
+
 #endif // V_CLONE_IMPLEMENTATION
@@ -0,0 +1,249 @@
+// Reproduz um log de teclas contra um arquivo, sem TTY, e mede o motor modal.
+//
+//   v_replay [-r linhas] [-c colunas] [-n repetições] [-o saida.ansi] arquivo log
+//
+// O log são os bytes crus lidos do terminal (v_clone grava um com V_KEYLOG=log).
+// Cada tecla passa por v_process_key e v_render, como numa digitação lenta; a
+// saída vai para um terminal nulo que só conta bytes (ou para -o, se dado).
+// Relata percentis de latência por tecla, bytes por quadro e alocações por tecla.
+// Colagens (ESC[200~ ... ESC[201~) vão inteiras para v_paste e contam como uma tecla.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Toda alocação do editor e do v_clone passa por aqui
+static size_t alloc_count;
+static void *count_malloc(size_t sz) { alloc_count++; return malloc(sz); }
+static void *count_realloc(void *p, size_t sz) { alloc_count++; return realloc(p, sz); }
+
+#define EDITOR_MALLOC(sz) count_malloc(sz)
+#define EDITOR_IMPLEMENTATION
+#include "editor.h"
+
+#define TERMINAL_IMPLEMENTATION
+#include "terminal.h"
+
+#define SYNTAX_IMPLEMENTATION
+#include "syntax.h"
+
+#define V_REALLOC(p, sz) count_realloc(p, sz)
+#include "v_clone.h"
+
+#define INITIAL_ED_CAP 1024
+#define PASTE_BEGIN    "\033[200~"
+#define PASTE_END      "\033[201~"
+#define PASTE_MARK_LEN 6
+#define SCREEN_ROWS    40
+#define SCREEN_COLS    120
+
+typedef struct {
+    editor_t ed;
+    v_state_t v;
+    const syntax_lang_t *lang;
+} Replay_t;
+
+static Replay_t R;
+
+// Mesmas sequências do v_clone.c, para que os bytes por quadro sejam os reais
+#define V_CLR_RESET()     term_reset()
+#define V_CLR_TEXT()      do { term_reset(); term_fg_rgb(240, 240, 240); } while(0)
+#define V_CLR_LINENUM()   term_fg_rgb(221, 160, 221)
+#define V_CLR_STATUS()    do { term_fg_rgb(40, 40, 40); term_bg_rgb(186, 225, 255); } while(0)
+#define V_CLR_SELECTION() term_bg_rgb(60, 60, 60)
+#define V_CLR_MATCH()     term_bg_rgb(90, 80, 40)
+#define V_CLR_SYNTAX(k)   term_fg_rgb(186, 225, 255) // A paleta real também tem 3 dígitos por canal
+
+#define V_TERM_GOTOXY(x, y)      term_gotoxy(x, y)
+#define V_TERM_CLEAR()           term_clear()
+#define V_TERM_CURSOR_SHOW(s)    term_cursor_show(s)
+
+#define V_ED_GET_CURSOR(v)          editor_get_cursor(&((Replay_t*)(v)->udata)->ed)
+#define V_ED_SET_CURSOR(v, pos)     editor_move_cursor(&((Replay_t*)(v)->udata)->ed, pos)
+#define V_ED_GET_CHAR(v, pos)       editor_get_char(&((Replay_t*)(v)->udata)->ed, pos)
+#define V_ED_GET_LENGTH(v)          editor_get_length(&((Replay_t*)(v)->udata)->ed)
+#define V_ED_DELETE_RANGE(v, s, e)  editor_delete_range(&((Replay_t*)(v)->udata)->ed, s, e)
+#define V_ED_INSERT_TEXT(v, txt)    editor_insert_text(&((Replay_t*)(v)->udata)->ed, txt)
+#define V_ED_INSERT_BYTES(v, t, n)  editor_insert_bytes(&((Replay_t*)(v)->udata)->ed, t, n)
+#define V_ED_SAVE_SNAPSHOT(v)       editor_save_snapshot(&((Replay_t*)(v)->udata)->ed)
+#define V_ED_UNDO(v)                editor_undo(&((Replay_t*)(v)->udata)->ed)
+#define V_ED_FIND_LINE_START(v, p)  editor_find_line_start(&((Replay_t*)(v)->udata)->ed, p)
+#define V_ED_FIND_LINE_END(v, p)    editor_find_line_end(&((Replay_t*)(v)->udata)->ed, p)
+#define V_ED_GET_ROW_COL(v, p, r, c) editor_get_row_col(&((Replay_t*)(v)->udata)->ed, p, r, c)
+#define V_ED_COPY_RANGE(v, s, e, d) editor_copy_range(&((Replay_t*)(v)->udata)->ed, s, e, d)
+#define V_ED_LINE_COUNT(v)          editor_line_count(&((Replay_t*)(v)->udata)->ed)
+#define V_ED_LINE_OFFSET(v, l)      editor_line_offset(&((Replay_t*)(v)->udata)->ed, l)
+#define V_ED_LINE_OF(v, p)          editor_line_of(&((Replay_t*)(v)->udata)->ed, p)
+#define V_ED_FIND(v, q, n, s, e)    editor_find_range(&((Replay_t*)(v)->udata)->ed, q, n, s, e)
+#define V_SYN_LEX(v, st, t, n, out) syntax_lex_line(((Replay_t*)(v)->udata)->lang, st, t, n, out)
+
+// :q encerra a reprodução; :w não escreve nada, para o arquivo servir de novo
+#define V_ACTION_COMMAND(v, cmd) do { if (strcmp(cmd, "q") == 0) (v)->running = 0; } while(0)
+
+#define V_CLONE_IMPLEMENTATION
+#include "v_clone.h"
+
+// --- Terminal nulo ---
+// stdout vira um stream que só conta bytes (e opcionalmente os grava)
+static size_t out_bytes;
+static FILE *out_file;
+
+static ssize_t null_write(void *cookie, const char *buf, size_t n) {
+    (void)cookie;
+    out_bytes += n;
+    if (out_file) fwrite(buf, 1, n, out_file);
+    return (ssize_t)n;
+}
+
+static long long now_ns(void) {
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Mesma normalização das colagens do v_clone.c (\r e \r\n viram \n)
+static size_t paste_normalize(char *s, size_t len) {
+    size_t w = 0;
+    for (size_t r = 0; r < len; r++) {
+        if (s[r] == '\r') { s[w++] = '\n'; if (r + 1 < len && s[r + 1] == '\n') r++; }
+        else s[w++] = s[r];
+    }
+    return w;
+}
+
+static void on_text_change(void *udata, const editor_change_t *c) {
+    v_text_changed((v_state_t *)udata, c->offset, c->removed, c->inserted, c->line, c->lines_removed, c->lines_inserted);
+}
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static long long pct(const long long *sorted, size_t n, double p) {
+    if (n == 0) return 0;
+    size_t i = (size_t)(p / 100.0 * (double)(n - 1) + 0.5);
+    return sorted[i];
+}
+
+static void report(const char *name, long long *samples, size_t n, double scale, const char *unit) {
+    long long sum = 0;
+    for (size_t i = 0; i < n; i++) sum += samples[i];
+    qsort(samples, n, sizeof(long long), cmp_ll);
+    fprintf(stderr, "%-9s mean %9.2f  p50 %9.2f  p90 %9.2f  p99 %9.2f  p99.9 %9.2f  max %9.2f %s\n", name,
+            n ? (double)sum / (double)n / scale : 0.0, pct(samples, n, 50) / scale, pct(samples, n, 90) / scale,
+            pct(samples, n, 99) / scale, pct(samples, n, 99.9) / scale, n ? samples[n - 1] / scale : 0.0, unit);
+}
+
+static char *read_all(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *buf = malloc(sz > 0 ? (size_t)sz : 1);
+    *len = fread(buf, 1, sz > 0 ? (size_t)sz : 0, f);
+    fclose(f);
+    return buf;
+}
+
+// Termina o trabalho de fundo (realce, contagem da busca) fora da medição,
+// como o tempo ocioso entre duas teclas faria
+static void drain_background(void) {
+    while (v_background(&R.v) & V_BG_MORE) {}
+}
+
+int main(int argc, char **argv) {
+    int rows = SCREEN_ROWS, cols = SCREEN_COLS, repeat = 1;
+    const char *out_path = NULL;
+    int a = 1;
+    for (; a + 1 < argc && argv[a][0] == '-'; a += 2) {
+        if (strcmp(argv[a], "-r") == 0) rows = atoi(argv[a + 1]);
+        else if (strcmp(argv[a], "-c") == 0) cols = atoi(argv[a + 1]);
+        else if (strcmp(argv[a], "-n") == 0) repeat = atoi(argv[a + 1]);
+        else if (strcmp(argv[a], "-o") == 0) out_path = argv[a + 1];
+        else break;
+    }
+    if (argc - a != 2) {
+        fprintf(stderr, "uso: %s [-r linhas] [-c colunas] [-n repetições] [-o saida.ansi] arquivo log\n", argv[0]);
+        return 2;
+    }
+    size_t log_len;
+    char *keys = read_all(argv[a + 1], &log_len);
+    if (!keys) { perror(argv[a + 1]); return 1; }
+    if (out_path && !(out_file = fopen(out_path, "wb"))) { perror(out_path); return 1; }
+
+    cookie_io_functions_t io = { NULL, null_write, NULL, NULL };
+    stdout = fopencookie(NULL, "w", io);
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+
+    v_init(&R.v);
+    R.v.udata = &R;
+    R.v.screen_rows = rows; R.v.screen_cols = cols;
+    if (!editor_load_file(&R.ed, argv[a])) editor_init(&R.ed, INITIAL_ED_CAP);
+    editor_set_observer(&R.ed, on_text_change, &R.v);
+    char first_line[128];
+    size_t fl = editor_copy_range(&R.ed, 0, sizeof(first_line), first_line);
+    R.lang = syntax_detect(argv[a], first_line, fl);
+    R.v.syntax = R.lang != NULL;
+    v_render(&R.v);
+    drain_background();
+
+    size_t cap = log_len * (size_t)(repeat > 0 ? repeat : 1) + 1, n = 0;
+    long long *t_key = malloc(sizeof(long long) * cap), *t_render = malloc(sizeof(long long) * cap);
+    long long *t_total = malloc(sizeof(long long) * cap), *bytes = malloc(sizeof(long long) * cap);
+    long long *allocs = malloc(sizeof(long long) * cap);
+
+    long long start = now_ns();
+    for (int r = 0; r < repeat && R.v.running; r++) {
+        for (size_t i = 0; i < log_len && R.v.running; i++) {
+            // Mesma tradução de process_pending_input
+            int key = (unsigned char)keys[i];
+            if (key == 127 || key == 8) key = V_KEY_BACKSPACE;
+            if (key == 13 || key == 10) key = V_KEY_ENTER;
+            // Colagem: o corpo vai de uma vez; sem ESC[201~ ela vai até o fim do log
+            char *paste = NULL;
+            size_t paste_len = 0;
+            if (key == V_KEY_ESC && log_len - i >= PASTE_MARK_LEN && memcmp(keys + i, PASTE_BEGIN, PASTE_MARK_LEN) == 0) {
+                size_t from = i + PASTE_MARK_LEN;
+                char *end = memmem(keys + from, log_len - from, PASTE_END, PASTE_MARK_LEN);
+                paste_len = end ? (size_t)(end - keys) - from : log_len - from;
+                paste = malloc(paste_len + 1); // O log é reaproveitado a cada repetição
+                if (!paste) { perror("malloc"); return 1; }
+                memcpy(paste, keys + from, paste_len);
+                paste_len = paste_normalize(paste, paste_len);
+                i = end ? (size_t)(end - keys) + PASTE_MARK_LEN - 1 : log_len;
+            }
+
+            size_t a0 = alloc_count, b0 = out_bytes;
+            long long t0 = now_ns();
+            if (paste) v_paste(&R.v, paste, paste_len); else v_process_key(&R.v, key);
+            long long t1 = now_ns();
+            free(paste);
+            v_render(&R.v);
+            long long t2 = now_ns();
+
+            t_key[n] = t1 - t0; t_render[n] = t2 - t1; t_total[n] = t2 - t0;
+            bytes[n] = (long long)(out_bytes - b0);
+            allocs[n] = (long long)(alloc_count - a0);
+            n++;
+            drain_background();
+        }
+    }
+    double wall = (double)(now_ns() - start) / 1e9;
+
+    fprintf(stderr, "%zu teclas, %zu bytes no arquivo, %zu linhas, %.3f s\n",
+            n, editor_get_length(&R.ed), editor_line_count(&R.ed), wall);
+    report("key", t_key, n, 1000.0, "us");
+    report("render", t_render, n, 1000.0, "us");
+    report("total", t_total, n, 1000.0, "us");
+    report("bytes", bytes, n, 1.0, "B/quadro");
+    report("allocs", allocs, n, 1.0, "/tecla");
+
+    v_free(&R.v);
+    editor_free(&R.ed);
+    free(keys); free(t_key); free(t_render); free(t_total); free(bytes); free(allocs);
+    fclose(stdout);
+    if (out_file) fclose(out_file);
+    return 0;
+}